@@ -4,13 +4,109 @@
  */
 
 #include <Arduino.h>
+#include "ArduinoBridge.h"
 
 uint32_t arduino_millis()
 {
 	return millis();
 }
 
+uint32_t arduino_micros()
+{
+	return micros();
+}
+
 int32_t arduino_random(int32_t min, int32_t max)
 {
 	return random(min, max);
 }
+
+#if defined(ESP32)
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#define TASK_STACK 8192
+#define TASK_PRIORITY 2
+
+struct ArduinoTask {
+	TaskHandle_t handle;
+	SemaphoreHandle_t done;
+	arduino_task_fn fn;
+	void *arg;
+};
+
+static void task_trampoline(void *arg)
+{
+	ArduinoTask *task = (ArduinoTask*) arg;
+	task->fn(task->arg);
+	xSemaphoreGive(task->done);
+	// FreeRTOS tasks must not return
+	vTaskDelete(NULL);
+}
+
+void *arduino_task_start(arduino_task_fn fn, void *arg, int core)
+{
+	ArduinoTask *task = new ArduinoTask();
+	task->fn = fn;
+	task->arg = arg;
+	task->done = xSemaphoreCreateBinary();
+	if (xTaskCreatePinnedToCore(task_trampoline, "loral2", TASK_STACK, task,
+			TASK_PRIORITY, &task->handle, core) != pdPASS) {
+		vSemaphoreDelete(task->done);
+		delete task;
+		return 0;
+	}
+	return task;
+}
+
+void arduino_task_join(void *t)
+{
+	ArduinoTask *task = (ArduinoTask*) t;
+	xSemaphoreTake(task->done, portMAX_DELAY);
+	vSemaphoreDelete(task->done);
+	delete task;
+}
+
+void arduino_task_notify(void *t)
+{
+	ArduinoTask *task = (ArduinoTask*) t;
+	if (xPortInIsrContext()) {
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(task->handle, &woken);
+		if (woken) {
+			portYIELD_FROM_ISR();
+		}
+	} else {
+		xTaskNotifyGive(task->handle);
+	}
+}
+
+void arduino_task_wait(uint32_t timeout_ms)
+{
+	ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms));
+}
+
+#else
+
+// No tasks on this platform
+
+void *arduino_task_start(arduino_task_fn fn, void *arg, int core)
+{
+	return 0;
+}
+
+void arduino_task_join(void *task)
+{
+}
+
+void arduino_task_notify(void *task)
+{
+}
+
+void arduino_task_wait(uint32_t timeout_ms)
+{
+}
+
+#endif
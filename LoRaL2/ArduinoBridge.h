@@ -11,6 +11,49 @@
 #include <cstdint>
 
 uint32_t arduino_millis();
+uint32_t arduino_micros();
 int32_t arduino_random(int32_t min, int32_t max);
 
+#if !defined(ARDUINO)
+
+// Host builds only: time source behind arduino_millis() and
+// arduino_micros(). The default is the wall clock; tests may install
+// a virtual clock and move it forward at will.
+
+class ArduinoClock {
+public:
+	virtual ~ArduinoClock() {};
+	// microseconds since some arbitrary origin
+	virtual uint64_t now_us() = 0;
+};
+
+// NULL restores the wall clock. The clock must outlive its use.
+void arduino_set_clock(ArduinoClock *clock);
+
+// Clock that stands still until set or advanced
+class ArduinoVirtualClock: public ArduinoClock {
+public:
+	ArduinoVirtualClock(uint64_t start_us = 0);
+	virtual uint64_t now_us();
+	void set(uint64_t us);
+	void advance(uint64_t us);
+private:
+	uint64_t t;
+};
+
+#endif
+
+// Task support, used by the optional LoRaL2 worker.
+// FreeRTOS on ESP32, std::thread on Linux, unsupported elsewhere
+// (arduino_task_start() returns NULL).
+
+typedef void (*arduino_task_fn)(void *arg);
+
+void *arduino_task_start(arduino_task_fn fn, void *arg, int core);
+void arduino_task_join(void *task);
+// wakes up task; may be called from interrupt context
+void arduino_task_notify(void *task);
+// called by the task itself, returns when notified or after timeout
+void arduino_task_wait(uint32_t timeout_ms);
+
 #endif
@@ -0,0 +1,124 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <string.h>
+#include "Compress.h"
+
+#define TOKEN_MATCH 0x80
+
+// Octet at position pos of dictionary followed by data; negative
+// positions are in the dictionary
+static inline uint8_t at(const uint8_t *dict, size_t dict_len, const uint8_t *data, long pos)
+{
+	return pos < 0 ? dict[dict_len + pos] : data[pos];
+}
+
+// Emits in[start..end) as literal runs
+static bool put_literals(const uint8_t *in, size_t start, size_t end,
+		uint8_t *out, size_t &o, size_t out_max)
+{
+	while (start < end) {
+		size_t n = end - start;
+		if (n > LORAL2_LZ_MAX_LITERALS) n = LORAL2_LZ_MAX_LITERALS;
+		if (o + 1 + n > out_max) {
+			return false;
+		}
+		out[o++] = n - 1;
+		memcpy(out + o, in + start, n);
+		o += n;
+		start += n;
+	}
+	return true;
+}
+
+size_t LoRaL2Compress::compress(const uint8_t *dict, size_t dict_len,
+		const uint8_t *in, size_t len, uint8_t *out)
+{
+	if (len < 2) {
+		return 0;
+	}
+	if (!dict) {
+		dict_len = 0;
+	}
+	size_t out_max = len - 1;
+	size_t o = 0;
+	size_t literals = 0;	// start of pending literals
+
+	for (size_t i = 0; i < len; ) {
+		size_t max_len = len - i;
+		if (max_len > LORAL2_LZ_MAX_MATCH) max_len = LORAL2_LZ_MAX_MATCH;
+		size_t max_dist = i + dict_len;
+		if (max_dist > LORAL2_LZ_WINDOW) max_dist = LORAL2_LZ_WINDOW;
+
+		// longest match, nearest first; may overlap the current position
+		size_t best_len = 0;
+		size_t best_dist = 0;
+		for (size_t dist = 1; max_len >= LORAL2_LZ_MIN_MATCH && dist <= max_dist; ++dist) {
+			long src = (long) i - (long) dist;
+			size_t n = 0;
+			while (n < max_len && at(dict, dict_len, in, src + n) == in[i + n]) {
+				++n;
+			}
+			if (n > best_len) {
+				best_len = n;
+				best_dist = dist;
+				if (n == max_len) break;
+			}
+		}
+
+		if (best_len < LORAL2_LZ_MIN_MATCH) {
+			++i;
+			continue;
+		}
+		if (!put_literals(in, literals, i, out, o, out_max) || o + 2 > out_max) {
+			return 0;
+		}
+		out[o++] = TOKEN_MATCH | ((best_len - LORAL2_LZ_MIN_MATCH) << 2) | ((best_dist - 1) >> 8);
+		out[o++] = (best_dist - 1) & 0xff;
+		i += best_len;
+		literals = i;
+	}
+
+	if (!put_literals(in, literals, len, out, o, out_max)) {
+		return 0;
+	}
+	return o;
+}
+
+int LoRaL2Compress::decompress(const uint8_t *dict, size_t dict_len,
+		const uint8_t *in, size_t len, uint8_t *out, size_t out_max)
+{
+	if (!dict) {
+		dict_len = 0;
+	}
+	size_t o = 0;
+	for (size_t i = 0; i < len; ) {
+		uint8_t token = in[i++];
+		if (!(token & TOKEN_MATCH)) {
+			size_t n = token + 1;
+			if (i + n > len || o + n > out_max) {
+				return -1;
+			}
+			memcpy(out + o, in + i, n);
+			i += n;
+			o += n;
+			continue;
+		}
+
+		if (i >= len) {
+			return -1;
+		}
+		size_t n = ((token >> 2) & 0x1f) + LORAL2_LZ_MIN_MATCH;
+		size_t dist = (((token & 0x03) << 8) | in[i++]) + 1;
+		if (dist > o + dict_len || o + n > out_max) {
+			return -1;
+		}
+		// octet by octet, the source may overlap what is being written
+		for (size_t k = 0; k < n; ++k, ++o) {
+			out[o] = at(dict, dict_len, out, (long) o - (long) dist);
+		}
+	}
+	return o;
+}
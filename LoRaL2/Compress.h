@@ -0,0 +1,40 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Small LZ77 variant for payloads, with an optional static dictionary
+// (e.g. the keys of a JSON-ish telemetry format) known to both sides.
+// The dictionary acts as data already seen, so even short payloads find
+// matches. No tables, no allocation: compression is a brute-force search
+// over a window of LORAL2_LZ_WINDOW octets, which is fine for payloads
+// of a few hundred octets.
+//
+// Stream of tokens:
+//   0nnnnnnn                    n+1 literal octets follow
+//   1lllllDD dddddddd           copy l+3 octets from distance D:d + 1
+
+#ifndef __COMPRESS_H
+#define __COMPRESS_H
+
+#include <cstddef>
+#include <cinttypes>
+
+#define LORAL2_LZ_WINDOW 1024
+#define LORAL2_LZ_MIN_MATCH 3
+#define LORAL2_LZ_MAX_MATCH (LORAL2_LZ_MIN_MATCH + 31)
+#define LORAL2_LZ_MAX_LITERALS 128
+
+class LoRaL2Compress {
+public:
+	// Returns the compressed length, or 0 if it would not be shorter than
+	// len. out must have room for len - 1 octets.
+	static size_t compress(const uint8_t *dict, size_t dict_len,
+			const uint8_t *in, size_t len, uint8_t *out);
+	// Returns the decompressed length, or -1 if the data is malformed
+	// or does not fit in out_max octets.
+	static int decompress(const uint8_t *dict, size_t dict_len,
+			const uint8_t *in, size_t len, uint8_t *out, size_t out_max);
+};
+
+#endif
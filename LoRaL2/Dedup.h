@@ -0,0 +1,81 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Duplicate frame suppression, for nodes that hear the same frame from
+// several relays or retransmissions. Fixed memory: a ring of hashes of
+// the last LORAL2_DEDUP_SLOTS frames, each valid for a time window.
+
+#ifndef __DEDUP_H
+#define __DEDUP_H
+
+#include <cinttypes>
+#include <cstddef>
+
+#ifndef LORAL2_DEDUP_SLOTS
+#define LORAL2_DEDUP_SLOTS 32
+#endif
+
+class LoRaL2Dedup {
+public:
+	LoRaL2Dedup(const LoRaL2Dedup&) = delete;
+	void operator=(const LoRaL2Dedup&) = delete;
+
+	LoRaL2Dedup(uint32_t window_ms): window(window_ms), next(0), used(0),
+		hits(0), misses(0) {}
+
+	// Returns true if the same content was seen within the window,
+	// otherwise remembers it. Called by a single consumer.
+	bool seen(const uint8_t *data, size_t len, uint32_t now_ms) {
+		uint32_t h = hash(data, len);
+		for (size_t i = 0; i < used; ++i) {
+			// unsigned arithmetic handles millis() wraparound
+			if (ring[i].hash == h && (now_ms - ring[i].time) < window) {
+				__atomic_store_n(&hits, hits + 1, __ATOMIC_RELAXED);
+				return true;
+			}
+		}
+		ring[next].hash = h;
+		ring[next].time = now_ms;
+		next = (next + 1) % LORAL2_DEDUP_SLOTS;
+		if (used < LORAL2_DEDUP_SLOTS) {
+			++used;
+		}
+		__atomic_store_n(&misses, misses + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	uint32_t hit_count() const {
+		return __atomic_load_n(&hits, __ATOMIC_RELAXED);
+	}
+
+	uint32_t miss_count() const {
+		return __atomic_load_n(&misses, __ATOMIC_RELAXED);
+	}
+
+	// FNV-1a, with the length mixed in
+	static uint32_t hash(const uint8_t *data, size_t len) {
+		uint32_t h = 2166136261u ^ len;
+		for (size_t i = 0; i < len; ++i) {
+			h ^= data[i];
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+private:
+	struct Entry {
+		uint32_t hash;
+		uint32_t time;
+	};
+
+	Entry ring[LORAL2_DEDUP_SLOTS];
+	uint32_t window;
+	size_t next;
+	size_t used;
+	uint32_t hits;
+	uint32_t misses;
+};
+
+#endif
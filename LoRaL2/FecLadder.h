@@ -0,0 +1,210 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Compile-time ladder of Reed-Solomon codes. A payload is protected by
+// the smallest code whose message size fits it; the payload is padded
+// with zeros up to the code size, but only payload and parity are sent.
+// The receiver finds the code from the frame length alone, so all nodes
+// of a network must be built with the same ladder.
+//
+// Tiers are listed in ascending message size, with non-decreasing parity
+// (otherwise frame lengths would be ambiguous). Products may build with
+// a finer ladder, e.g.
+//
+//	-DLORAL2_FEC_LADDER="FecLadder<FecCode<32,8>,FecCode<64,12>,FecCode<128,16>,FecCode<230,20>>"
+
+#ifndef __FECLADDER_H
+#define __FECLADDER_H
+
+#include <cstddef>
+#include <cinttypes>
+#include <cstring>
+#include "src/RS-FEC.h"
+
+// Frame length not produced by any code of the ladder
+#define FEC_ERR_LENGTH 999
+// Decoding failure at tier n (0 = smallest code) is FEC_ERR_TIER0 - n
+#define FEC_ERR_TIER0 998
+
+template <size_t K, size_t PARITY>
+struct FecCode {
+	static_assert(K > 0 && PARITY > 0, "empty FEC code");
+	static_assert(K + PARITY < 256, "FEC code longer than a LoRa frame");
+
+	static constexpr size_t k = K;
+	static constexpr size_t parity = PARITY;
+	static constexpr size_t n = K + PARITY;
+	static constexpr size_t scratch_size = RS::ReedSolomon<K, PARITY>::workspace_size;
+
+	// padded has k octets, zero-padded after the payload.
+	// Without a scratch, the codec uses the stack.
+	template <typename Scratch>
+	static void encode(const uint8_t *padded, uint8_t *ecc, Scratch *scratch)
+	{
+		if (scratch) {
+			codec.EncodeBlock(padded, ecc, *scratch);
+		} else {
+			codec.EncodeBlock(padded, ecc);
+		}
+	}
+
+	// padded and msg have k octets, padded must be zeroed
+	template <typename Scratch>
+	static int decode(const uint8_t *frame, size_t frame_len, uint8_t *padded,
+			uint8_t *msg, size_t &net_len, int tier, Scratch *scratch)
+	{
+		net_len = frame_len - PARITY;
+		memcpy(padded, frame, net_len);
+		int err = scratch ? codec.DecodeBlock(padded, frame + net_len, msg, *scratch)
+				: codec.DecodeBlock(padded, frame + net_len, msg);
+		return err ? FEC_ERR_TIER0 - tier : 0;
+	}
+
+	// read-only after construction, shared by all instances and threads
+	static const RS::ReedSolomon<K, PARITY> codec;
+};
+
+template <size_t K, size_t PARITY>
+constexpr size_t FecCode<K, PARITY>::k;
+template <size_t K, size_t PARITY>
+constexpr size_t FecCode<K, PARITY>::parity;
+template <size_t K, size_t PARITY>
+constexpr size_t FecCode<K, PARITY>::n;
+template <size_t K, size_t PARITY>
+constexpr size_t FecCode<K, PARITY>::scratch_size;
+template <size_t K, size_t PARITY>
+const RS::ReedSolomon<K, PARITY> FecCode<K, PARITY>::codec;
+
+template <typename... Codes>
+struct FecLadder;
+
+// Top tier
+template <typename Code>
+struct FecLadder<Code> {
+	static constexpr size_t tiers = 1;
+	static constexpr size_t max_k = Code::k;
+	static constexpr size_t max_n = Code::n;
+	static constexpr size_t min_parity = Code::parity;
+	static constexpr size_t max_parity = Code::parity;
+	static constexpr size_t scratch_size = Code::scratch_size;
+
+	// RS scratch memory that fits every code of the ladder. Passing one
+	// to encode() and decode() keeps it off the stack (one call at a time).
+	typedef RS::Scratch<scratch_size> Scratch;
+
+	// Message size of the code used for a payload length
+	static constexpr size_t code_k(size_t len)
+	{
+		return Code::k;
+	}
+
+	static constexpr size_t parity_len(size_t len)
+	{
+		return Code::parity;
+	}
+
+	// Tier of a frame, or -1 if no sender could have produced its
+	// length. min_len is the shortest payload this tier carries.
+	static constexpr int tier(size_t frame_len, size_t min_len = 0, int base = 0)
+	{
+		return frame_len >= min_len + Code::parity && frame_len <= Code::n ? base : -1;
+	}
+
+	// padded has max_k octets, zero-padded after the payload.
+	// Writes parity and returns its length. scratch may be any
+	// RS::Scratch that fits the ladder, or null to use the stack.
+	template <typename AnyScratch = Scratch>
+	static size_t encode(const uint8_t *padded, size_t len, uint8_t *ecc,
+			AnyScratch *scratch = 0)
+	{
+		Code::encode(padded, ecc, scratch);
+		return Code::parity;
+	}
+
+	// padded and msg have max_k octets, padded must be zeroed.
+	// Returns 0 or FEC_ERR_*.
+	template <typename AnyScratch = Scratch>
+	static int decode(const uint8_t *frame, size_t frame_len, uint8_t *padded,
+			uint8_t *msg, size_t &net_len, AnyScratch *scratch = 0,
+			size_t min_len = 0, int base = 0)
+	{
+		if (tier(frame_len, min_len, base) < 0) {
+			net_len = 0;
+			return FEC_ERR_LENGTH;
+		}
+		return Code::decode(frame, frame_len, padded, msg, net_len, base, scratch);
+	}
+};
+
+template <typename Code, typename Next, typename... Rest>
+struct FecLadder<Code, Next, Rest...> {
+	typedef FecLadder<Next, Rest...> Up;
+
+	static_assert(Code::k < Next::k, "FEC tiers must grow in message size");
+	static_assert(Code::parity <= Next::parity, "FEC tiers must not shrink in parity");
+
+	static constexpr size_t tiers = 1 + Up::tiers;
+	static constexpr size_t max_k = Up::max_k;
+	static constexpr size_t max_n = Up::max_n;
+	static constexpr size_t min_parity = Code::parity;
+	static constexpr size_t max_parity = Up::max_parity;
+	static constexpr size_t scratch_size = Code::scratch_size > Up::scratch_size ?
+					Code::scratch_size : Up::scratch_size;
+
+	typedef RS::Scratch<scratch_size> Scratch;
+
+	static constexpr size_t code_k(size_t len)
+	{
+		return len <= Code::k ? Code::k : Up::code_k(len);
+	}
+
+	static constexpr size_t parity_len(size_t len)
+	{
+		return len <= Code::k ? Code::parity : Up::parity_len(len);
+	}
+
+	static constexpr int tier(size_t frame_len, size_t min_len = 0, int base = 0)
+	{
+		return frame_len < min_len + Code::parity ? -1 :
+			frame_len <= Code::n ? base :
+			Up::tier(frame_len, Code::k + 1, base + 1);
+	}
+
+	template <typename AnyScratch = Scratch>
+	static size_t encode(const uint8_t *padded, size_t len, uint8_t *ecc,
+			AnyScratch *scratch = 0)
+	{
+		if (len <= Code::k) {
+			Code::encode(padded, ecc, scratch);
+			return Code::parity;
+		}
+		return Up::encode(padded, len, ecc, scratch);
+	}
+
+	template <typename AnyScratch = Scratch>
+	static int decode(const uint8_t *frame, size_t frame_len, uint8_t *padded,
+			uint8_t *msg, size_t &net_len, AnyScratch *scratch = 0,
+			size_t min_len = 0, int base = 0)
+	{
+		if (frame_len < min_len + Code::parity) {
+			net_len = 0;
+			return FEC_ERR_LENGTH;
+		}
+		if (frame_len > Code::n) {
+			return Up::decode(frame, frame_len, padded, msg, net_len, scratch,
+					Code::k + 1, base + 1);
+		}
+		return Code::decode(frame, frame_len, padded, msg, net_len, base, scratch);
+	}
+};
+
+// Ladder used by LoRaL2
+#ifndef LORAL2_FEC_LADDER
+#define LORAL2_FEC_LADDER FecLadder<FecCode<50, 10>, FecCode<100, 14>, FecCode<230, 20>>
+#endif
+
+typedef LORAL2_FEC_LADDER LoRaL2Fec;
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <string.h>
+#include "Handle.h"
+
+LoRaL2Handle::Slot LoRaL2Handle::pool[LORAL2_HANDLE_SLOTS];
+
+LoRaL2Handle LoRaL2Handle::copy(const uint8_t *data, size_t len, const LoRaL2Meta &meta)
+{
+	if (len > LORAL2_MAX_FRAME) {
+		return LoRaL2Handle();
+	}
+	for (size_t i = 0; i < LORAL2_HANDLE_SLOTS; ++i) {
+		Slot *s = &pool[i];
+		if (__atomic_exchange_n(&s->used, true, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		memcpy(s->buf, data, len);
+		s->len = len;
+		s->meta = meta;
+		return LoRaL2Handle(s);
+	}
+	return LoRaL2Handle();
+}
+
+size_t LoRaL2Handle::available()
+{
+	size_t n = 0;
+	for (size_t i = 0; i < LORAL2_HANDLE_SLOTS; ++i) {
+		if (!__atomic_load_n(&pool[i].used, __ATOMIC_RELAXED)) {
+			++n;
+		}
+	}
+	return n;
+}
+
+void LoRaL2Handle::reset()
+{
+	if (slot) {
+		__atomic_store_n(&slot->used, false, __ATOMIC_RELEASE);
+		slot = 0;
+	}
+}
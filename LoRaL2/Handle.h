@@ -0,0 +1,80 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Move-only handle to a received packet, for applications that handle
+// packets after the LoRaL2Receiver callback returns. Packets are copied
+// into a static pool of LORAL2_HANDLE_SLOTS buffers, so there is no heap
+// allocation; a slot returns to the pool when its handle is destroyed
+// or reset. Handles may be moved between threads.
+
+#ifndef __HANDLE_H
+#define __HANDLE_H
+
+#include <cstddef>
+#include <cinttypes>
+#include "LoRaL2.h"
+#include "RxRing.h"
+
+#ifndef LORAL2_HANDLE_SLOTS
+#define LORAL2_HANDLE_SLOTS 4
+#endif
+
+class LoRaL2Handle {
+public:
+	LoRaL2Handle(const LoRaL2Handle&) = delete;
+	void operator=(const LoRaL2Handle&) = delete;
+
+	LoRaL2Handle(): slot(0) {}
+	LoRaL2Handle(LoRaL2Handle &&other): slot(other.slot) {
+		other.slot = 0;
+	}
+	LoRaL2Handle& operator=(LoRaL2Handle &&other) {
+		if (this != &other) {
+			reset();
+			slot = other.slot;
+			other.slot = 0;
+		}
+		return *this;
+	}
+	~LoRaL2Handle() {
+		reset();
+	}
+
+	// Copies a packet into a free slot. The handle is empty if the pool
+	// is exhausted or the packet is too long.
+	static LoRaL2Handle copy(const uint8_t *data, size_t len, const LoRaL2Meta &meta);
+	// Free slots in the pool
+	static size_t available();
+
+	explicit operator bool() const {
+		return slot != 0;
+	}
+	const uint8_t *data() const {
+		return slot->buf;
+	}
+	size_t len() const {
+		return slot->len;
+	}
+	const LoRaL2Meta &meta() const {
+		return slot->meta;
+	}
+	// Returns the slot to the pool
+	void reset();
+
+private:
+	struct Slot {
+		uint8_t buf[LORAL2_MAX_FRAME];
+		size_t len;
+		LoRaL2Meta meta;
+		bool used;
+	};
+
+	explicit LoRaL2Handle(Slot *slot): slot(slot) {}
+
+	Slot *slot;
+	static Slot pool[LORAL2_HANDLE_SLOTS];
+};
+
+#endif
@@ -4,52 +4,138 @@
  */
 
 #include <stdlib.h>
-#include "src/RS-FEC.h"
 #include "src/AES.h"
+#include "src/AESFast.h"
 #include "src/sha256.h"
 #include "ArduinoBridge.h"
 #include "Radio.h"
+#include "RxRing.h"
+#include "Dedup.h"
+#include "FecLadder.h"
+#include "Trace.h"
+#include "Compress.h"
 
 #define POWER   20
 #define PABOOST 1
 #define CR4SLSH 5
 
-// FEC-related constants
-static const size_t MSGSIZ_SHORT = 50;
-static const size_t MSGSIZ_MEDIUM = 100;
-static const size_t MSGSIZ_LONG = 230;
-static const size_t REDUNDANCY_SHORT = 10;
-static const size_t REDUNDANCY_MEDIUM = 14;
-static const size_t REDUNDANCY_LONG = 20;
+// Compression flag, first octet of the payload when enabled
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ 1
+#define COMPRESS_FLAG_LEN 1
 
 // Crypto-related constant
 #define CRYPTO_MAGIC 0x05
 #define CRYPTO_LENGTH_LEN  2
 
+static_assert(LoRaL2Fec::max_k > 16 * 2 + CRYPTO_LENGTH_LEN,
+		"largest FEC code cannot carry an encrypted packet");
+
+// Host builds (e.g. gateways) use the AES-NI/T-table implementation
+#if defined(CRYPTO_AES_FAST)
+typedef AESFast256 L2AES256;
+#else
+typedef AES256 L2AES256;
+#endif
+
+// With LORAL2_FEC_SHARED_WORKSPACE, FEC works on a single static scratch
+// area, sized to the largest code, instead of putting the RS workspace
+// and padding buffers on the stack at every call. For targets with
+// little RAM or small task stacks (e.g. AVR). FEC may run in the radio
+// interrupt, so taking the workspace never blocks: a call that finds it
+// busy (another instance, task or an interrupted FEC call) falls back to
+// the stack. In deferred RX mode with a single task it is never busy.
+#ifdef LORAL2_FEC_SHARED_WORKSPACE
+static struct {
+	LoRaL2Fec::Scratch rs;
+	uint8_t padded[LoRaL2Fec::max_k];
+} fec_ws;
+static bool fec_ws_busy = false;
+
+static bool fec_ws_take()
+{
+	return !__atomic_test_and_set(&fec_ws_busy, __ATOMIC_ACQUIRE);
+}
+
+static void fec_ws_give()
+{
+	__atomic_clear(&fec_ws_busy, __ATOMIC_RELEASE);
+}
+#endif
+
 #define STATUS_IDLE 0
 #define STATUS_RECEIVING 1
 #define STATUS_TRANSMITTING 2
 
 #include "LoRaL2.h"
 
-LoRaL2::LoRaL2(long int band, int spread, int bandwidth,
+LoRaL2::LoRaL2(RadioDriver *radio, long int band, int spread, int bandwidth,
 		const char *key, size_t key_len,
-		LoRaL2Observer *observer)
+		LoRaL2Observer *observer): adapter(observer)
 {
+	this->radio = radio;
 	this->band = band;
 	this->spread = spread;
 	this->bandwidth = bandwidth;
 	this->hkey = hashed_key(key, key_len);
-	this->observer = observer;
+	this->receiver = &adapter;
 
 	this->status = STATUS_IDLE;
-
-	_ok = lora_start(band, spread, bandwidth, POWER, PABOOST, CR4SLSH, this);
+	this->deferred = false;
+	this->rx_ring = 0;
+	this->rx_claimed = 0;
+	this->worker = 0;
+	this->worker_stop = false;
+	this->pkt_queue = 0;
+	this->dedup = 0;
+	this->addressed = false;
+	this->address = LORAL2_BROADCAST;
+	this->n_addr_discards = 0;
+	this->compressed = false;
+	this->dict = 0;
+	this->dict_len = 0;
+	this->send_observer = 0;
+	this->tx_timeout_ms = 0;
+	this->tx_current.id = 0;
+	this->tx_air_us = 0;
+	this->tx_inflight = false;
+	this->tx_late = false;
+	this->tx_late_id = 0;
+	this->tx_reports = 0;
+#ifdef LORAL2_TRACE
+	this->trace_unit = loral2_trace_unit();
+#endif
+
+	_ok = radio->start(band, spread, bandwidth, POWER, PABOOST, CR4SLSH, this);
 }
 
 LoRaL2::~LoRaL2()
 {
+	stop_worker();
+	delete pkt_queue;
+	delete tx_reports;
 	free(hkey);
+	delete rx_ring;
+	delete dedup;
+}
+
+void LoRaL2::set_receiver(LoRaL2Receiver *receiver)
+{
+	this->receiver = receiver ? receiver : &adapter;
+}
+
+void LoRaL2ObserverAdapter::recv(const uint8_t *data, size_t len, const LoRaL2Meta &meta)
+{
+	// one extra octet, so the application may NUL-terminate text
+	uint8_t *packet = (uint8_t*) calloc(len + 1, sizeof(uint8_t));
+	memcpy(packet, data, len);
+	LoRaL2Packet *pkt = new LoRaL2Packet(packet, len, meta.rssi, meta.err);
+	pkt->src = meta.src;
+	pkt->dst = meta.dst;
+	pkt->snr = meta.snr;
+	pkt->freq_error = meta.freq_error;
+	pkt->time_us = meta.time_us;
+	observer->recv(pkt);
 }
 
 bool LoRaL2::ok() const
@@ -67,42 +153,394 @@ uint32_t LoRaL2::speed_bps() const
 	return bps;
 }
 
+// Worst case, i.e. payload not compressible
+size_t LoRaL2::frame_len(size_t payload_len) const
+{
+	size_t len = payload_len + (compressed ? COMPRESS_FLAG_LEN : 0);
+	if (hkey) {
+		L2AES256 aes256;
+		size_t block = aes256.blockSize();
+		len = ((block + CRYPTO_LENGTH_LEN + len - 1) / block + 1) * block;
+	}
+	if (addressed) {
+		len += LORAL2_ADDR_LEN;
+	}
+	return len + LoRaL2Fec::parity_len(len);
+}
+
+uint32_t LoRaL2::airtime_us(size_t payload_len) const
+{
+	return frame_airtime_us(spread, bandwidth, CR4SLSH, frame_len(payload_len));
+}
+
+// Semtech AN1200.13, explicit header, CRC off, 8-symbol preamble
+uint32_t LoRaL2::frame_airtime_us(int spread, int bandwidth, int cr4slsh, size_t frame_len)
+{
+	// low data rate optimization when symbols are longer than 16ms
+	int de = ((1L << spread) * 1000L > 16L * bandwidth) ? 1 : 0;
+	long num = 8L * frame_len - 4L * spread + 28;
+	long den = 4L * (spread - 2 * de);
+	long payload_symbols = 8 + (num > 0 ? (num + den - 1) / den * cr4slsh : 0);
+	// preamble + 4.25 symbols, in quarter symbols
+	uint64_t quarters = 4 * (8 + payload_symbols) + 17;
+	return quarters * (1UL << spread) * 1000000ULL / (4ULL * bandwidth);
+}
+
 void LoRaL2::resume_rx()
 {
 	if (status != STATUS_RECEIVING) {
 		status = STATUS_RECEIVING;
-		lora_receive();
+		radio->receive();
 	}
 }
 
 void LoRaL2::on_sent()
 {
+	// A frame that timed out may complete while the next one is on
+	// air; the latter cannot be done in less than half its airtime
+	if (__atomic_exchange_n(&tx_late, false, __ATOMIC_ACQ_REL) &&
+			tx_current.id != tx_late_id &&
+			arduino_micros() - tx_current.start_us < tx_air_us / 2) {
+		return;
+	}
 	status = STATUS_IDLE;
 	resume_rx();
+	tx_done(TX_OK);
+}
+
+void LoRaL2::set_send_observer(LoRaL2SendObserver *observer, uint32_t timeout_ms)
+{
+	send_observer = observer;
+	tx_timeout_ms = timeout_ms;
+	if (!tx_reports) {
+		tx_reports = new LoRaL2TxReportQueue();
+	}
+}
+
+uint32_t LoRaL2::tx_id() const
+{
+	return tx_current.id;
+}
+
+// Completes the frame in flight, if any, and returns whether there
+// was one. May run in interrupt context.
+bool LoRaL2::tx_done(int tx_status)
+{
+	// on_sent() and the timeout in poll() may race
+	if (!__atomic_exchange_n(&tx_inflight, false, __ATOMIC_ACQ_REL)) {
+		return false;
+	}
+	LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_TX_DONE, tx_status, tx_current.id);
+	tx_current.end_us = arduino_micros();
+	tx_current.status = tx_status;
+	if (!send_observer) {
+		return true;
+	}
+	if (!deferred) {
+		send_observer->sent(tx_current);
+		return true;
+	}
+	LoRaL2TxReport *slot = tx_reports->claim();
+	if (slot) {
+		*slot = tx_current;
+		tx_reports->publish();
+	}
+	return true;
+}
+
+LoRaL2RxInfo LoRaL2::rx_info(int rssi)
+{
+	LoRaL2RxInfo info;
+	info.rssi = rssi;
+	info.snr = 0;
+	info.freq_error = 0;
+	info.time_us = arduino_micros();
+	return info;
+}
+
+// Takes ownership of buffer
+void LoRaL2::on_recv(const LoRaL2RxInfo &info, uint8_t *buffer, size_t tot_len)
+{
+	LORAL2_TRACE_EVENT_AT(info.time_us, trace_unit, LORAL2_EV_RX_ISR, tot_len, info.rssi);
+	process_frame(info, buffer, tot_len);
+	free(buffer);
 }
 
 void LoRaL2::on_recv(int rssi, uint8_t *buffer, size_t tot_len)
 {
+	on_recv(rx_info(rssi), buffer, tot_len);
+}
+
+void LoRaL2::set_deferred_rx(bool enable)
+{
+	if (enable && !rx_ring) {
+		rx_ring = new LoRaL2RxRing();
+	}
+	deferred = enable;
+}
+
+bool LoRaL2::deferred_rx() const
+{
+	return deferred;
+}
+
+uint32_t LoRaL2::rx_dropped() const
+{
+	return (rx_ring ? rx_ring->drop_count() : 0) +
+		(pkt_queue ? pkt_queue->drop_count() : 0);
+}
+
+void LoRaL2::set_dedup(uint32_t window_ms)
+{
+	delete dedup;
+	dedup = window_ms ? new LoRaL2Dedup(window_ms) : 0;
+}
+
+uint32_t LoRaL2::dedup_hits() const
+{
+	return dedup ? dedup->hit_count() : 0;
+}
+
+uint32_t LoRaL2::dedup_misses() const
+{
+	return dedup ? dedup->miss_count() : 0;
+}
+
+void LoRaL2::set_address(uint16_t address)
+{
+	this->addressed = true;
+	this->address = address;
+}
+
+uint32_t LoRaL2::addr_discards() const
+{
+	return __atomic_load_n(&n_addr_discards, __ATOMIC_RELAXED);
+}
+
+void LoRaL2::set_compression(bool enable, const uint8_t *dict, size_t dict_len)
+{
+	this->compressed = enable;
+	this->dict = dict;
+	this->dict_len = dict ? dict_len : 0;
+}
+
+// Called by radio RX callback in deferred mode. Returns a buffer
+// where the raw frame should be copied, or NULL if the frame must
+// be dropped (ring full). Must be followed by on_recv_commit().
+uint8_t* LoRaL2::on_recv_slot()
+{
+	rx_claimed = rx_ring ? rx_ring->claim() : 0;
+	return rx_claimed ? rx_claimed->buf : 0;
+}
+
+void LoRaL2::on_recv_commit(int rssi, size_t len)
+{
+	on_recv_commit(rx_info(rssi), len);
+}
+
+void LoRaL2::on_recv_commit(const LoRaL2RxInfo &info, size_t len)
+{
+	if (!rx_claimed) {
+		LORAL2_TRACE_EVENT_AT(info.time_us, trace_unit, LORAL2_EV_RX_DROP, len, info.rssi);
+		return;
+	}
+	LORAL2_TRACE_EVENT_AT(info.time_us, trace_unit, LORAL2_EV_RX_ISR, len, info.rssi);
+	rx_claimed->len = len;
+	rx_claimed->info = info;
+	rx_claimed = 0;
+	rx_ring->publish();
+
+	void *w = __atomic_load_n(&worker, __ATOMIC_ACQUIRE);
+	if (w) {
+		arduino_task_notify(w);
+	}
+}
+
+size_t LoRaL2::poll()
+{
+	size_t count = 0;
+
+	if (send_observer) {
+		if (tx_timeout_ms && __atomic_load_n(&tx_inflight, __ATOMIC_ACQUIRE) &&
+				(arduino_micros() - tx_current.start_us) / 1000 >= tx_timeout_ms) {
+			status = STATUS_IDLE;
+			resume_rx();
+			if (tx_done(TX_ERR_TIMEOUT)) {
+				tx_late_id = tx_current.id;
+				__atomic_store_n(&tx_late, true, __ATOMIC_RELEASE);
+			}
+		}
+		LoRaL2TxReport *report;
+		while ((report = tx_reports->peek())) {
+			send_observer->sent(*report);
+			tx_reports->release();
+		}
+	}
+
+	// packets already processed by worker (even if it has been stopped)
+	LoRaL2DecodedFrame *pkt;
+	while (pkt_queue && (pkt = pkt_queue->peek())) {
+		LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_DISPATCH, pkt->len, pkt->meta.err);
+		receiver->recv(pkt->buf, pkt->len, pkt->meta);
+		pkt_queue->release();
+		++count;
+	}
+
+	if (worker_running()) {
+		return count;
+	}
+
+	LoRaL2RawFrame *frame;
+	while (rx_ring && (frame = rx_ring->peek())) {
+		process_frame(frame->info, frame->buf, frame->len);
+		rx_ring->release();
+		++count;
+	}
+	return count;
+}
+
+// how long the worker sleeps when idle, before checking whether it must stop
+#define WORKER_IDLE_MS 100
+
+bool LoRaL2::start_worker(int core)
+{
+	if (worker) {
+		return true;
+	}
+	set_deferred_rx(true);
+	if (!pkt_queue) {
+		pkt_queue = new LoRaL2PacketQueue();
+	}
+	__atomic_store_n(&worker_stop, false, __ATOMIC_RELEASE);
+	void *w = arduino_task_start(worker_main, this, core);
+	__atomic_store_n(&worker, w, __ATOMIC_RELEASE);
+	return w != 0;
+}
+
+void LoRaL2::stop_worker()
+{
+	void *w = __atomic_load_n(&worker, __ATOMIC_ACQUIRE);
+	if (!w) {
+		return;
+	}
+	__atomic_store_n(&worker_stop, true, __ATOMIC_RELEASE);
+	arduino_task_notify(w);
+	arduino_task_join(w);
+	__atomic_store_n(&worker, (void*) 0, __ATOMIC_RELEASE);
+}
+
+bool LoRaL2::worker_running() const
+{
+	return __atomic_load_n(&worker, __ATOMIC_ACQUIRE) != 0;
+}
+
+void LoRaL2::worker_main(void *arg)
+{
+	LoRaL2 *self = (LoRaL2*) arg;
+	while (!__atomic_load_n(&self->worker_stop, __ATOMIC_ACQUIRE)) {
+		self->worker_step();
+		arduino_task_wait(WORKER_IDLE_MS);
+	}
+	self->worker_step();
+}
+
+// Worker: turns queued raw frames into packets for poll()
+void LoRaL2::worker_step()
+{
+	LoRaL2RawFrame *frame;
+	while ((frame = rx_ring->peek())) {
+		// decoded straight into the queue slot
+		LoRaL2DecodedFrame *slot = pkt_queue->claim();
+		if (!slot) {
+			// application is not calling poll() fast enough
+			rx_ring->release();
+			continue;
+		}
+		static_cast<LoRaL2RxInfo&>(slot->meta) = frame->info;
+		bool ok = decode_frame(frame->buf, frame->len, slot->buf, slot->len, slot->meta);
+		rx_ring->release();
+		if (ok) {
+			pkt_queue->publish();
+		}
+	}
+}
+
+void LoRaL2::process_frame(const LoRaL2RxInfo &info, const uint8_t *buffer, size_t tot_len)
+{
+	uint8_t packet[LoRaL2Fec::max_k];
+	size_t len;
+	LoRaL2Meta meta;
+	static_cast<LoRaL2RxInfo&>(meta) = info;
+	if (decode_frame(buffer, tot_len, packet, len, meta)) {
+		LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_DISPATCH, len, meta.err);
+		receiver->recv(packet, len, meta);
+	}
+}
+
+// Decodes a frame into packet, which must have room for LoRaL2Fec::max_k
+// octets. The LoRaL2RxInfo part of meta must be set by the caller. Returns false if the frame
+// is a duplicate, or addressed to another node.
+bool LoRaL2::decode_frame(const uint8_t *buffer, size_t tot_len, uint8_t *packet,
+		size_t &packet_len, LoRaL2Meta &meta)
+{
+	uint8_t encrypted_packet[LoRaL2Fec::max_k];
 	size_t encrypted_len = 0;
-	int err = 0;
-	uint8_t *encrypted_packet = decode_fec(buffer, tot_len, encrypted_len, err);
-	free(buffer);
+	int err = decode_fec_into(buffer, tot_len, encrypted_packet, encrypted_len);
+
+	// address header, checked before anything else is spent on the frame
+	uint16_t src = LORAL2_BROADCAST;
+	uint16_t dst = LORAL2_BROADCAST;
+	size_t hdr_len = 0;
+	if (!err && addressed) {
+		if (encrypted_len < LORAL2_ADDR_LEN) {
+			err = ADDR_ERR_SHORT;
+		} else {
+			dst = (encrypted_packet[0] << 8) | encrypted_packet[1];
+			src = (encrypted_packet[2] << 8) | encrypted_packet[3];
+			if (dst != address && dst != LORAL2_BROADCAST) {
+				LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_ADDR_DISCARD, dst, 0);
+				__atomic_store_n(&n_addr_discards, n_addr_discards + 1,
+						__ATOMIC_RELAXED);
+				return false;
+			}
+			hdr_len = LORAL2_ADDR_LEN;
+		}
+	}
+
+	if (!err && dedup && dedup->seen(encrypted_packet, encrypted_len, arduino_millis())) {
+		LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_DUPLICATE, 0, 0);
+		return false;
+	}
 	
-	uint8_t *packet;
-	size_t packet_len = 0;
 	if (!err) {
-		packet = decrypt(encrypted_packet, encrypted_len, packet_len, err);
-		free(encrypted_packet);
+		err = decrypt_into(encrypted_packet + hdr_len, encrypted_len - hdr_len,
+				packet, packet_len);
+		LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_DECRYPT, err, packet_len);
+		if (!err && compressed) {
+			// encrypted_packet is free by now
+			err = uncompress(packet, packet_len, encrypted_packet);
+		}
 	} else {
-		packet = encrypted_packet;
+		memcpy(packet, encrypted_packet, encrypted_len);
 		packet_len = encrypted_len;
 	}
 
-	observer->recv(new LoRaL2Packet(packet, packet_len, rssi, err));
+	meta.err = err;
+	meta.src = src;
+	meta.dst = dst;
+	return true;
 }
 
 bool LoRaL2::send(const uint8_t *packet, size_t payload_len)
 {
+	return send_to(LORAL2_BROADCAST, packet, payload_len);
+}
+
+bool LoRaL2::send_to(uint16_t dst, const uint8_t *packet, size_t payload_len)
+{
+	uint32_t enqueue_us = arduino_micros();
+	LORAL2_TRACE_EVENT_AT(enqueue_us, trace_unit, LORAL2_EV_TX_ENQUEUE, payload_len, 0);
+
 	if (status == STATUS_TRANSMITTING) {
 		return false;
 	}
@@ -112,19 +550,57 @@ bool LoRaL2::send(const uint8_t *packet, size_t payload_len)
 	}
 
 	// should not happen because of 'status' protection
-	if (! lora_begin_packet()) return false;
+	if (! radio->begin_packet()) return false;
+
+	uint8_t zipped[LoRaL2Fec::max_k];
+	if (compressed) {
+		size_t zipped_len = LoRaL2Compress::compress(dict, dict_len, packet,
+				payload_len, zipped + COMPRESS_FLAG_LEN);
+		zipped[0] = zipped_len ? COMPRESS_LZ : COMPRESS_NONE;
+		if (!zipped_len) {
+			memcpy(zipped + COMPRESS_FLAG_LEN, packet, payload_len);
+			zipped_len = payload_len;
+		}
+		packet = zipped;
+		payload_len = zipped_len + COMPRESS_FLAG_LEN;
+	}
 
+	// FEC covers the header, so it is written in place, right before
+	// the encrypted payload
+	size_t header_len = addressed ? LORAL2_ADDR_LEN : 0;
 	size_t encrypted_len;
-	uint8_t* encrypted_packet = encrypt(packet, payload_len, encrypted_len);
+	uint8_t* encrypted_packet = encrypt(packet, payload_len, encrypted_len, header_len);
+	encrypted_len += header_len;
+
+	if (addressed) {
+		encrypted_packet[0] = dst >> 8;
+		encrypted_packet[1] = dst & 0xff;
+		encrypted_packet[2] = address >> 8;
+		encrypted_packet[3] = address & 0xff;
+	}
 
-	size_t tot_len;
-	uint8_t* fec_packet = append_fec(encrypted_packet, encrypted_len, tot_len);
-	free(encrypted_packet);
+	// parity is streamed into radio right after the packet,
+	// no need to assemble them in a single buffer
+	uint8_t parity[LoRaL2Fec::max_parity];
+	RadioFrag frags[2];
+	frags[0].data = encrypted_packet;
+	frags[0].len = encrypted_len;
+	frags[1].data = parity;
+	frags[1].len = fec_parity(encrypted_packet, encrypted_len, parity);
 
 	status = STATUS_TRANSMITTING;
-	lora_finish_packet(fec_packet, tot_len);
+	tx_current.id++;
+	// before the radio call, which may complete synchronously
+	tx_current.enqueue_us = enqueue_us;
+	tx_current.start_us = arduino_micros();
+	tx_air_us = frame_airtime_us(spread, bandwidth, CR4SLSH,
+			frags[0].len + frags[1].len);
+	__atomic_store_n(&tx_inflight, true, __ATOMIC_RELEASE);
+	LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_TX_START,
+			frags[0].len + frags[1].len, tx_current.id);
+	radio->finish_packet_sg(frags, 2);
 
-	free(fec_packet);
+	free(encrypted_packet);
 
 	return true;
 }
@@ -135,6 +611,11 @@ LoRaL2Packet::LoRaL2Packet(uint8_t *packet, size_t len, int rssi, int err)
 	this->len = len;
 	this->rssi = rssi;
 	this->err = err;
+	this->snr = 0;
+	this->freq_error = 0;
+	this->time_us = 0;
+	this->src = LORAL2_BROADCAST;
+	this->dst = LORAL2_BROADCAST;
 }
 	
 LoRaL2Packet::~LoRaL2Packet()
@@ -142,96 +623,113 @@ LoRaL2Packet::~LoRaL2Packet()
 	free(packet);
 }
 
-RS::ReedSolomon<MSGSIZ_SHORT, REDUNDANCY_SHORT> rsf_short;
-RS::ReedSolomon<MSGSIZ_MEDIUM, REDUNDANCY_MEDIUM> rsf_medium;
-RS::ReedSolomon<MSGSIZ_LONG, REDUNDANCY_LONG> rsf_long;
-
 size_t LoRaL2::max_payload() const
 {
+	size_t max_k = LoRaL2Fec::max_k - (addressed ? LORAL2_ADDR_LEN : 0) -
+			(compressed ? COMPRESS_FLAG_LEN : 0);
 	if (hkey) {
-		AES256 aes256;
-		return MSGSIZ_LONG - aes256.blockSize() * 2 - CRYPTO_LENGTH_LEN;
+		L2AES256 aes256;
+		return max_k - aes256.blockSize() * 2 - CRYPTO_LENGTH_LEN;
 	}
-	return MSGSIZ_LONG;
+	return max_k;
 }
 
 uint8_t *LoRaL2::append_fec(const uint8_t* packet, size_t len, size_t& new_len)
 {
 	// safety measure, should never happen
-	if (len > MSGSIZ_LONG) len = MSGSIZ_LONG;
-
-	new_len = len;
+	if (len > LoRaL2Fec::max_k) len = LoRaL2Fec::max_k;
 
-	uint8_t* rs_unencoded    = (uint8_t*) calloc(MSGSIZ_LONG,                   sizeof(char));
-	uint8_t* rs_encoded      = (uint8_t*) calloc(MSGSIZ_LONG + REDUNDANCY_LONG, sizeof(char));
-	uint8_t* packet_with_fec = (uint8_t*) calloc(len         + REDUNDANCY_LONG, sizeof(char));
-
-	memcpy(rs_unencoded,    packet, len);
+	uint8_t* packet_with_fec = (uint8_t*) calloc(len + LoRaL2Fec::max_parity, sizeof(char));
 	memcpy(packet_with_fec, packet, len);
+	new_len = len + fec_parity(packet, len, packet_with_fec + len);
 
-	if (len <= MSGSIZ_SHORT) {
-		rsf_short.Encode(rs_unencoded, rs_encoded);
-		new_len += REDUNDANCY_SHORT;
-		memcpy(packet_with_fec + len, rs_encoded + MSGSIZ_SHORT, REDUNDANCY_SHORT);
-	} else if (len <= MSGSIZ_MEDIUM) {
-		rsf_medium.Encode(rs_unencoded, rs_encoded);
-		new_len += REDUNDANCY_MEDIUM;
-		memcpy(packet_with_fec + len, rs_encoded + MSGSIZ_MEDIUM, REDUNDANCY_MEDIUM);
-	} else {
-		rsf_long.Encode(rs_unencoded, rs_encoded);
-		new_len += REDUNDANCY_LONG;
-		memcpy(packet_with_fec + len, rs_encoded + MSGSIZ_LONG, REDUNDANCY_LONG);
+	return packet_with_fec;
+}
+
+// Calculates FEC parity of packet. parity must have room for
+// LoRaL2Fec::max_parity octets. Returns the actual parity length.
+size_t LoRaL2::fec_parity(const uint8_t* packet, size_t len, uint8_t* parity)
+{
+	// safety measure, should never happen
+	if (len > LoRaL2Fec::max_k) len = LoRaL2Fec::max_k;
+
+#ifdef LORAL2_FEC_SHARED_WORKSPACE
+	if (fec_ws_take()) {
+		memset(fec_ws.padded, 0, sizeof(fec_ws.padded));
+		memcpy(fec_ws.padded, packet, len);
+		size_t parity_len = LoRaL2Fec::encode(fec_ws.padded, len, parity, &fec_ws.rs);
+		fec_ws_give();
+		return parity_len;
 	}
+#endif
+	// RS codes have fixed message size, pad with zeros
+	uint8_t* rs_unencoded = (uint8_t*) calloc(LoRaL2Fec::max_k, sizeof(char));
+	memcpy(rs_unencoded, packet, len);
+
+	size_t parity_len = LoRaL2Fec::encode(rs_unencoded, len, parity);
 
-	free(rs_encoded);
 	free(rs_unencoded);
 
-	return packet_with_fec;
+	return parity_len;
 }
 
 uint8_t *LoRaL2::decode_fec(const uint8_t* packet_with_fec, size_t len, size_t& net_len, int& err)
 {
-	uint8_t* rs_encoded = (uint8_t*) calloc(MSGSIZ_LONG + REDUNDANCY_LONG, sizeof(char));
-	uint8_t* rs_decoded = (uint8_t*) calloc(MSGSIZ_LONG,                   sizeof(char));
-	uint8_t* packet     = (uint8_t*) calloc(len,                           sizeof(char));
-
-	err = 0;
-	net_len = len;
-
-	if (len < REDUNDANCY_SHORT || len > (MSGSIZ_LONG + REDUNDANCY_LONG)) {
-		net_len = 0;
-		err = 999;
-
-	} else if (len <= (MSGSIZ_SHORT + REDUNDANCY_SHORT)) {
-		net_len -= REDUNDANCY_SHORT;
-		memcpy(rs_encoded, packet_with_fec, net_len);
-		memcpy(rs_encoded + MSGSIZ_SHORT, packet_with_fec + net_len, REDUNDANCY_SHORT);
-		if (rsf_short.Decode(rs_encoded, rs_decoded)) {
-			err = 998;
-		}
+	uint8_t* packet = (uint8_t*) calloc(LoRaL2Fec::max_k, sizeof(char));
+	err = decode_fec_into(packet_with_fec, len, packet, net_len);
+	return packet;
+}
 
-	} else if (len <= (MSGSIZ_MEDIUM + REDUNDANCY_MEDIUM)) {
-		net_len -= REDUNDANCY_MEDIUM;
-		memcpy(rs_encoded, packet_with_fec, net_len);
-		memcpy(rs_encoded + MSGSIZ_MEDIUM, packet_with_fec + net_len, REDUNDANCY_MEDIUM);
-		if (rsf_medium.Decode(rs_encoded, rs_decoded)) {
-			err = 997;
-		}
+// out must have room for LoRaL2Fec::max_k octets. Returns 0 or FEC_ERR_*.
+int LoRaL2::decode_fec_into(const uint8_t* packet_with_fec, size_t len, uint8_t *out, size_t& net_len)
+{
+	int err;
+#ifdef LORAL2_FEC_SHARED_WORKSPACE
+	if (fec_ws_take()) {
+		memset(fec_ws.padded, 0, sizeof(fec_ws.padded));
+		err = LoRaL2Fec::decode(packet_with_fec, len, fec_ws.padded, out,
+					net_len, &fec_ws.rs);
+		fec_ws_give();
+	} else
+#endif
+	{
+		uint8_t rs_padded[LoRaL2Fec::max_k];
+		memset(rs_padded, 0, sizeof(rs_padded));
+		err = LoRaL2Fec::decode(packet_with_fec, len, rs_padded, out, net_len);
+	}
+#ifdef LORAL2_TRACE
+	// only the message part is compared, corrected parity is not counted
+	int corrected = 0;
+	for (size_t i = 0; !err && i < net_len; ++i) {
+		corrected += packet_with_fec[i] != out[i];
+	}
+	LORAL2_TRACE_EVENT(trace_unit, LORAL2_EV_FEC, err, corrected);
+#endif
+	return err;
+}
 
-	} else {
-		net_len -= REDUNDANCY_LONG;
-		memcpy(rs_encoded, packet_with_fec, net_len);
-		memcpy(rs_encoded + MSGSIZ_LONG, packet_with_fec + net_len, REDUNDANCY_LONG);
-		if (rsf_long.Decode(rs_encoded, rs_decoded)) {
-			err = 996;
-		}
+// Replaces packet, flag octet included, by the original payload. packet
+// and scratch must have room for LoRaL2Fec::max_k octets.
+// Returns 0 or COMPRESS_ERR_DATA, leaving packet as is.
+int LoRaL2::uncompress(uint8_t *packet, size_t &len, uint8_t *scratch)
+{
+	if (len < COMPRESS_FLAG_LEN || packet[0] > COMPRESS_LZ) {
+		return COMPRESS_ERR_DATA;
 	}
-	
-	free(rs_encoded);
-	memcpy(packet, rs_decoded, net_len);
-	free(rs_decoded);
-	
-	return packet;
+	size_t data_len = len - COMPRESS_FLAG_LEN;
+	if (packet[0] == COMPRESS_NONE) {
+		memmove(packet, packet + COMPRESS_FLAG_LEN, data_len);
+		len = data_len;
+		return 0;
+	}
+	int n = LoRaL2Compress::decompress(dict, dict_len, packet + COMPRESS_FLAG_LEN,
+			data_len, scratch, LoRaL2Fec::max_k);
+	if (n < 0) {
+		return COMPRESS_ERR_DATA;
+	}
+	memcpy(packet, scratch, n);
+	len = n;
+	return 0;
 }
 
 uint8_t* LoRaL2::hashed_key(const char *key, size_t len)
@@ -248,7 +746,7 @@ uint8_t* LoRaL2::hashed_key(const char *key, size_t len)
 	}
 	const uint8_t* res = hash.result();
 
-	AES256 aes256;
+	L2AES256 aes256;
 	uint8_t* hkey = (uint8_t*) calloc(aes256.keySize(), sizeof(uint8_t));
 	for (size_t i = 0; i < aes256.keySize(); ++i) {
 		hkey[i] = res[i % HASH_LENGTH]; // constant from sha256.h
@@ -266,16 +764,19 @@ void LoRaL2::gen_iv(uint8_t* buffer, size_t len)
 	}
 }
 
-uint8_t *LoRaL2::encrypt(const uint8_t *packet, size_t payload_len, size_t& tot_len)
+// The result starts with headroom octets, left for the caller to fill
+// (e.g. a header); tot_len does not count them.
+uint8_t *LoRaL2::encrypt(const uint8_t *packet, size_t payload_len, size_t& tot_len,
+		size_t headroom)
 {
 	if (! hkey) {
 		tot_len = payload_len;
-		uint8_t* copy = (uint8_t*) malloc(payload_len);
-		memcpy(copy, packet, payload_len);
+		uint8_t* copy = (uint8_t*) malloc(headroom + payload_len);
+		memcpy(copy + headroom, packet, payload_len);
 		return copy;
 	}
 
-	AES256 aes256;
+	L2AES256 aes256;
 	uint8_t* ukey = (uint8_t*) calloc(sizeof(uint8_t), aes256.keySize());
 	memcpy(ukey, hkey, aes256.keySize());
 	aes256.setKey(ukey, aes256.keySize());
@@ -285,7 +786,8 @@ uint8_t *LoRaL2::encrypt(const uint8_t *packet, size_t payload_len, size_t& tot_
 	size_t enc_blocks = (tot_len - 1) / aes256.blockSize() + 1;
 	tot_len = enc_blocks * aes256.blockSize();
 
-	uint8_t* buffer = (uint8_t*) calloc(1, tot_len);
+	uint8_t* frame = (uint8_t*) calloc(1, headroom + tot_len);
+	uint8_t* buffer = frame + headroom;
 	gen_iv(buffer, aes256.blockSize());
 	buffer[aes256.blockSize() + 0] = payload_len % 256;
 	buffer[aes256.blockSize() + 1] = payload_len / 256;
@@ -302,78 +804,64 @@ uint8_t *LoRaL2::encrypt(const uint8_t *packet, size_t payload_len, size_t& tot_
 		aes256.encryptBlock(buffer + offset, buffer + offset);
 	}
 
-	return buffer;
+	return frame;
 }
 
 uint8_t *LoRaL2::decrypt(const uint8_t *enc_packet, size_t tot_len, size_t& pay_len, int& err)
 {
 	uint8_t* packet = (uint8_t*) calloc(tot_len + 1, sizeof(uint8_t));
+	err = decrypt_into(enc_packet, tot_len, packet, pay_len);
+	return packet;
+}
 
+// out must have room for tot_len octets, and must not overlap enc_packet.
+// On error, out is a copy of enc_packet.
+int LoRaL2::decrypt_into(const uint8_t *enc_packet, size_t tot_len, uint8_t *out, size_t& pay_len)
+{
 	if (!hkey) {
-		err = 0;
 		pay_len = tot_len;
-		memcpy(packet, enc_packet, tot_len);
-		return packet;
+		memcpy(out, enc_packet, tot_len);
+		return 0;
 	}
 
 	// if receiver has the wrong key, the payload will be mangled and will
 	// be most probably rejected
 
-	AES256 aes256;
-	uint8_t* ukey = (uint8_t*) calloc(sizeof(uint8_t), aes256.keySize());
-	memcpy(ukey, hkey, aes256.keySize());
-	aes256.setKey(ukey, aes256.keySize());
-	free(ukey);
+	L2AES256 aes256;
+	aes256.setKey(hkey, aes256.keySize());
 
 	if (tot_len < (2 * aes256.blockSize())) {
 		// packet too short
-		err = 1001;
 		pay_len = tot_len;
-		memcpy(packet, enc_packet, tot_len);
-		return packet;
+		memcpy(out, enc_packet, tot_len);
+		return 1001;
 	}
 
 	if (tot_len % aes256.blockSize() != 0) {
 		// packet not a multiple of block
-		err = 1002;
 		pay_len = tot_len;
-		memcpy(packet, enc_packet, tot_len);
-		return packet;
+		memcpy(out, enc_packet, tot_len);
+		return 1002;
 	}
 
 	size_t blocks = tot_len / aes256.blockSize();
 
-	uint8_t* buffer_interm = (uint8_t*) malloc(tot_len);
-	memcpy(buffer_interm, enc_packet, tot_len);
-
-	for (size_t i = blocks - 1; i >= 1; --i) {
-		size_t offset = i * aes256.blockSize();
-		size_t offset_ant = (i - 1) * aes256.blockSize();
-		// decrypt
-		aes256.decryptBlock(buffer_interm + offset, buffer_interm + offset);
-		// de-scramble based on previous block
-		for (size_t j = 0; j < aes256.blockSize(); ++j) {
-			buffer_interm[offset + j] ^= buffer_interm[offset_ant + j];
-		}
-	}
+	// all blocks at once, chained from the IV sent in clear
+	aes256.decryptBlocksCBC(out + aes256.blockSize(),
+				enc_packet + aes256.blockSize(), blocks - 1, enc_packet);
 
-	pay_len = buffer_interm[aes256.blockSize() + 0] +
-			buffer_interm[aes256.blockSize() + 1] * 256;
+	pay_len = out[aes256.blockSize() + 0] +
+			out[aes256.blockSize() + 1] * 256;
 	size_t calc_enc_len = aes256.blockSize() + CRYPTO_LENGTH_LEN + pay_len;
 	size_t calc_blocks = (calc_enc_len - 1) / aes256.blockSize() + 1;
 
 	if (blocks != calc_blocks) {
 		// block incompatible with alleged payload length
-		free(buffer_interm);
-		err = 1003;
 		pay_len = tot_len;
-		memcpy(packet, enc_packet, tot_len);
-		return packet;
+		memcpy(out, enc_packet, tot_len);
+		return 1003;
 	}
 
-	memcpy(packet, buffer_interm + aes256.blockSize() + CRYPTO_LENGTH_LEN, pay_len);
-	free(buffer_interm);
-
-	err = 0;
-	return packet;
+	memmove(out, out + aes256.blockSize() + CRYPTO_LENGTH_LEN, pay_len);
+	return 0;
 }
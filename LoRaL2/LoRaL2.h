@@ -9,6 +9,31 @@
 #include <cstddef>
 #include <cinttypes>
 
+// Link-layer addressing (see LoRaL2::set_address)
+#define LORAL2_ADDR_LEN 4
+#define LORAL2_BROADCAST 0xffff
+// Frame too short for the address header
+#define ADDR_ERR_SHORT 1004
+// Compressed payload is malformed (see LoRaL2::set_compression)
+#define COMPRESS_ERR_DATA 1005
+
+// Reception conditions, captured by the radio driver in the RX interrupt
+struct LoRaL2RxInfo {
+	int rssi;		// dBm
+	float snr;		// dB
+	int32_t freq_error;	// Hz, 0 if unknown
+	uint32_t time_us;	// arduino_micros() at RX done
+};
+
+// Metadata of a received packet
+struct LoRaL2Meta: LoRaL2RxInfo {
+	int err;
+	// LORAL2_BROADCAST unless addressing is enabled
+	uint16_t src;
+	uint16_t dst;
+};
+
+// Packet as delivered to a LoRaL2Observer, which owns it
 class LoRaL2Packet {
 public:
 	LoRaL2Packet(const LoRaL2Packet&) = delete;
@@ -22,47 +47,205 @@ public:
 	size_t len;
 	int rssi;
 	int err;
+	// LORAL2_BROADCAST unless addressing is enabled
+	uint16_t src;
+	uint16_t dst;
+	// see LoRaL2RxInfo
+	float snr;
+	int32_t freq_error;
+	uint32_t time_us;
 };
 
+class RadioDriver;
+class LoRaL2RxRing;
+class LoRaL2PacketQueue;
+class LoRaL2TxReportQueue;
+class LoRaL2Dedup;
+struct LoRaL2RawFrame;
+
+// Core where the worker task runs by default. Arduino loop() runs on core 1.
+#ifndef LORAL2_WORKER_CORE
+#define LORAL2_WORKER_CORE 0
+#endif
+
 class LoRaL2Observer {
 public:
 	virtual void recv(LoRaL2Packet*) = 0;
 	virtual ~LoRaL2Observer() {};
 };
 
+// Receive callback without heap allocation: data is borrowed and only
+// valid during the call. Use LoRaL2Handle (Handle.h) to keep it longer.
+class LoRaL2Receiver {
+public:
+	virtual void recv(const uint8_t *data, size_t len, const LoRaL2Meta &meta) = 0;
+	virtual ~LoRaL2Receiver() {};
+};
+
+// Final status of a transmission
+#define TX_OK 0
+// Radio did not report the end of transmission in time
+#define TX_ERR_TIMEOUT 1201
+
+// Completion of a send(). Timestamps are arduino_micros().
+struct LoRaL2TxReport {
+	uint32_t id;		// LoRaL2::tx_id() right after send()
+	uint32_t enqueue_us;	// send() called
+	uint32_t start_us;	// frame handed to the radio
+	uint32_t end_us;	// radio reported end of transmission
+	int status;
+};
+
+class LoRaL2SendObserver {
+public:
+	virtual void sent(const LoRaL2TxReport &report) = 0;
+	virtual ~LoRaL2SendObserver() {};
+};
+
+// Delivers to a LoRaL2Observer, allocating a LoRaL2Packet per packet
+class LoRaL2ObserverAdapter: public LoRaL2Receiver {
+public:
+	LoRaL2ObserverAdapter(LoRaL2Observer *observer): observer(observer) {}
+	virtual void recv(const uint8_t *data, size_t len, const LoRaL2Meta &meta);
+
+	LoRaL2Observer *observer;
+};
+
 class LoRaL2 {
 public:
 	LoRaL2(const LoRaL2&) = delete;
 	void operator=(const LoRaL2&) = delete;
 	
-	LoRaL2(long int band, int spread, int bandwidth,
+	// radio is not owned by LoRaL2, and must outlive it
+	LoRaL2(RadioDriver *radio, long int band, int spread, int bandwidth,
 		const char *key, size_t key_len, LoRaL2Observer *);
 	virtual ~LoRaL2();
+
+	// Delivers packets to receiver instead of the observer.
+	// NULL restores the observer. Call before start_worker().
+	void set_receiver(LoRaL2Receiver *receiver);
 	
 	bool send(const uint8_t *packet, size_t payload_len);
 	uint32_t speed_bps() const;
 	size_t max_payload() const;
+	// Frame length and time on air of a payload
+	size_t frame_len(size_t payload_len) const;
+	uint32_t airtime_us(size_t payload_len) const;
+	static uint32_t frame_airtime_us(int spread, int bandwidth, int cr4slsh, size_t frame_len);
 	bool ok() const;
-	// public because LoRa C API needs to call them
+
+	// Deferred RX mode: the radio callback just queues raw frames,
+	// and poll() (called e.g. from loop()) does FEC, decryption
+	// and observer dispatch. Returns the number of frames processed.
+	void set_deferred_rx(bool);
+	bool deferred_rx() const;
+	size_t poll();
+	uint32_t rx_dropped() const;
+
+	// Worker mode (ESP32 and Linux only): implies deferred RX, and a
+	// task pinned to another core does FEC and decryption. poll()
+	// just dispatches the finished packets to the observer.
+	bool start_worker(int core = LORAL2_WORKER_CORE);
+	void stop_worker();
+	bool worker_running() const;
+
+	// Duplicate suppression: frames with the same content as one
+	// received less than window_ms ago are dropped after FEC, before
+	// decryption and observer dispatch. 0 disables it (the default).
+	// Call before start_worker().
+	void set_dedup(uint32_t window_ms);
+	uint32_t dedup_hits() const;
+	uint32_t dedup_misses() const;
+
+	// Link-layer addressing: frames carry destination and source
+	// addresses in clear, protected by FEC, ahead of the encrypted
+	// payload. Frames addressed to other nodes are dropped right after
+	// FEC, without decryption or packet allocation. All nodes of a
+	// network must enable it. Call before start_worker().
+	void set_address(uint16_t address);
+	// send() is a broadcast when addressing is enabled
+	bool send_to(uint16_t dst, const uint8_t *packet, size_t payload_len);
+	uint32_t addr_discards() const;
+
+	// Payload compression, ahead of encryption, with an optional
+	// dictionary of content common to most payloads. Each frame has
+	// a flag octet, and goes uncompressed if compression does not
+	// shrink it. All nodes of a network must enable it, with the same
+	// dictionary, which must outlive the instance.
+	void set_compression(bool enable, const uint8_t *dict = 0, size_t dict_len = 0);
+
+	// Send completion: observer gets a report per frame sent, from the
+	// radio callback, or from poll() in deferred RX or worker mode.
+	// With a timeout (ms, 0 = none, the default), poll() gives up on
+	// a radio that does not report the end of a transmission.
+	void set_send_observer(LoRaL2SendObserver *observer, uint32_t timeout_ms = 0);
+	// Id of the last frame accepted by send()
+	uint32_t tx_id() const;
+
+	// public because radio drivers need to call them. Drivers that only
+	// know the RSSI may use the int overloads, which take the time of
+	// the call as RX time.
+	void on_recv(const LoRaL2RxInfo &info, uint8_t* packet, size_t len);
 	void on_recv(int rssi, uint8_t* packet, size_t len);
+	uint8_t* on_recv_slot();
+	void on_recv_commit(const LoRaL2RxInfo &info, size_t len);
+	void on_recv_commit(int rssi, size_t len);
 	void on_sent();
 
 	/* private */
+	void process_frame(const LoRaL2RxInfo &info, const uint8_t* packet, size_t len);
+	static LoRaL2RxInfo rx_info(int rssi);
+	bool decode_frame(const uint8_t* frame, size_t frame_len, uint8_t *packet,
+			size_t &len, LoRaL2Meta &meta);
+	static void worker_main(void *arg);
+	void worker_step();
 	void resume_rx();
-	uint8_t *encrypt(const uint8_t *packet, size_t len, size_t& new_len);
+	bool tx_done(int status);
+	uint8_t *encrypt(const uint8_t *packet, size_t len, size_t& new_len, size_t headroom = 0);
 	uint8_t *append_fec(const uint8_t *packet, size_t len, size_t& new_len);
+	size_t fec_parity(const uint8_t *packet, size_t len, uint8_t *parity);
 	uint8_t *decode_fec(const uint8_t *packet, size_t len, size_t& new_len, int& err);
+	int decode_fec_into(const uint8_t *packet, size_t len, uint8_t *out, size_t& new_len);
 	uint8_t *decrypt(const uint8_t *packet, size_t len, size_t& new_len, int& err);
+	int decrypt_into(const uint8_t *packet, size_t len, uint8_t *out, size_t& new_len);
+	int uncompress(uint8_t *packet, size_t &len, uint8_t *scratch);
 	static uint8_t *hashed_key(const char* key, size_t len);
 	static void gen_iv(uint8_t* buffer, size_t len);
 
+	RadioDriver *radio;
 	long int band;
 	int spread;
 	int bandwidth;
 	uint8_t *hkey;
-	LoRaL2Observer *observer;
+	LoRaL2ObserverAdapter adapter;
+	LoRaL2Receiver *receiver;
 	int status;
 	bool _ok;
+	bool deferred;
+	LoRaL2RxRing *rx_ring;
+	LoRaL2RawFrame *rx_claimed;
+	void *worker;
+	bool worker_stop;
+	LoRaL2PacketQueue *pkt_queue;
+	LoRaL2Dedup *dedup;
+	bool addressed;
+	uint16_t address;
+	uint32_t n_addr_discards;
+	bool compressed;
+	const uint8_t *dict;
+	size_t dict_len;
+	LoRaL2SendObserver *send_observer;
+	uint32_t tx_timeout_ms;
+	LoRaL2TxReport tx_current;
+	uint32_t tx_air_us;
+	bool tx_inflight;
+	// frame that timed out, whose completion may still come
+	bool tx_late;
+	uint32_t tx_late_id;
+	LoRaL2TxReportQueue *tx_reports;
+#ifdef LORAL2_TRACE
+	uint8_t trace_unit;
+#endif
 };
 
 #endif
@@ -5,12 +5,15 @@
 
 #include "SSD1306.h"
 #include "LoRaL2.h"
+#include "Handle.h"
+#include "Radio.h"
 #include "ArduinoBridge.h"
 
 #define BAND    916750000
 #define SPREAD  7
 #define BWIDTH  125000
 
+RadioSX127x radio;
 LoRaL2 *l2;
 char myid[5];
 
@@ -18,13 +21,19 @@ char myid[5];
 
 #define HALF_SEND_INTERVAL 5000
 
-class RecvObserver: public LoRaL2Observer
+// Keeps received packets until loop() shows them. Handles come from a
+// fixed pool, so nothing is allocated per packet.
+#define RECV_QUEUE LORAL2_HANDLE_SLOTS
+
+class RecvQueue: public LoRaL2Receiver
 {
   public:
-	virtual void recv(LoRaL2Packet*);
+	virtual void recv(const uint8_t*, size_t, const LoRaL2Meta&);
+	LoRaL2Handle queue[RECV_QUEUE];
+	size_t count = 0;
 };
 
-RecvObserver *recv_observer = new RecvObserver();
+RecvQueue recv_queue;
 
 void oled_show(const char* msg, const char *msg2 = 0);
 
@@ -41,9 +50,12 @@ void setup()
 	Serial.println(myid);
 
 	// Pass NULL as encryption key for cleartext communication
-	l2 = new LoRaL2(BAND, SPREAD, BWIDTH,
+	l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
 			ENCRYPTION_KEY, strlen(ENCRYPTION_KEY),
-			recv_observer);
+			0);
+	l2->set_receiver(&recv_queue);
+	// FEC and decryption run in loop() context, via poll()
+	l2->set_deferred_rx(true);
 	if (l2->ok()) {
 		Serial.println("Started");
 	} else {
@@ -53,13 +65,13 @@ void setup()
 	oled_init();
 }
 
-static LoRaL2Packet *pending_recv = 0;
 long int next_send = arduino_millis() + HALF_SEND_INTERVAL +
 			arduino_random(0, HALF_SEND_INTERVAL * 2);
 
 void loop()
 {	
-	handle_received_packet();
+	l2->poll();
+	show_received();
 	send_packet();
 }
 
@@ -94,40 +106,41 @@ void send_packet()
 			arduino_random(0, HALF_SEND_INTERVAL * 2);
 }
 
-// called by loop()
-void handle_received_packet()
+// RX callback, called by l2->poll() from loop() since deferred RX is on.
+// data is only valid during the call, so it is copied into a handle.
+void RecvQueue::recv(const uint8_t* data, size_t len, const LoRaL2Meta& meta)
 {
-	if (! pending_recv) {
+	if (count >= RECV_QUEUE) {
+		Serial.println("Recv queue full");
 		return;
 	}
-
-	String msg;
-	String msg2 = "  RSSI " + String(pending_recv->rssi) + " len " + String(pending_recv->len);
-	if (pending_recv->err) {
-		msg = "Recv with ERROR " + String(pending_recv->err);
-	} else {
-		msg = "Recv " + String((const char *) pending_recv->packet);
+	queue[count] = LoRaL2Handle::copy(data, len, meta);
+	if (queue[count]) {
+		++count;
 	}
-	
-	Serial.println(msg);
-	Serial.println(msg2);
-	oled_show(msg.c_str(), msg2.c_str());
-
-	delete pending_recv;
-	pending_recv = 0;
 }
 
-
-// RX callback
-// Takes the ownership of packet and its contents
-// Do as little as possible here! (E.g. oled_show() may crash)
-void RecvObserver::recv(LoRaL2Packet* pkt)
+void show_received()
 {
-	if (pending_recv) {
-		delete pending_recv;
+	for (size_t i = 0; i < recv_queue.count; ++i) {
+		LoRaL2Handle pkt = std::move(recv_queue.queue[i]);
+		String msg;
+		String msg2 = "  RSSI " + String(pkt.meta().rssi) + " len " + String(pkt.len());
+		if (pkt.meta().err) {
+			msg = "Recv with ERROR " + String(pkt.meta().err);
+		} else {
+			msg = "Recv ";
+			for (size_t j = 0; j < pkt.len(); ++j) {
+				msg += (char) pkt.data()[j];
+			}
+		}
+
+		Serial.println(msg);
+		Serial.println(msg2);
+		oled_show(msg.c_str(), msg2.c_str());
+		// pkt goes back to the pool here
 	}
-	// leave the packet for handle_received_packet() to handle
-	pending_recv = pkt;
+	recv_queue.count = 0;
 }
 
 SSD1306 display(0x3c, 4, 15);
@@ -0,0 +1,230 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ArduinoBridge.h"
+#include "Mesh.h"
+
+// Airtime budget window
+#define CAP_WINDOW_MS 60000
+// Added to the frame airtime to make a relay slot
+#define SLOT_GUARD_MS 10
+
+LoRaL2Mesh::LoRaL2Mesh(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, LoRaL2Observer *observer):
+	dedup(LORAL2_MESH_DEDUP_MS)
+{
+	this->observer = observer;
+	memset(pending, 0, sizeof(pending));
+	cap_permille = 10;
+	window_start = arduino_millis();
+	window_used_us = 0;
+	suppress = 1;
+	n_relayed = n_cancelled = n_dropped = n_duplicates = 0;
+
+	l2 = new LoRaL2(radio, band, spread, bandwidth, key, key_len, this);
+	// packets are handled in poll(), where relays may be sent
+	l2->set_deferred_rx(true);
+}
+
+LoRaL2Mesh::~LoRaL2Mesh()
+{
+	delete l2;
+	for (size_t i = 0; i < LORAL2_MESH_PENDING; ++i) {
+		free(pending[i].packet);
+	}
+}
+
+LoRaL2 *LoRaL2Mesh::link()
+{
+	return l2;
+}
+
+size_t LoRaL2Mesh::max_payload() const
+{
+	return l2->max_payload() - LORAL2_MESH_HDR_LEN;
+}
+
+void LoRaL2Mesh::set_airtime_cap(uint32_t permille)
+{
+	cap_permille = permille;
+}
+
+void LoRaL2Mesh::set_suppress(int copies)
+{
+	suppress = copies;
+}
+
+uint32_t LoRaL2Mesh::relayed() const
+{
+	return n_relayed;
+}
+
+uint32_t LoRaL2Mesh::relays_cancelled() const
+{
+	return n_cancelled;
+}
+
+uint32_t LoRaL2Mesh::relays_dropped() const
+{
+	return n_dropped;
+}
+
+uint32_t LoRaL2Mesh::duplicates() const
+{
+	return n_duplicates;
+}
+
+bool LoRaL2Mesh::send(const uint8_t *packet, size_t payload_len, int ttl)
+{
+	if (payload_len > max_payload()) {
+		return false;
+	}
+	if (ttl < 0) ttl = 0;
+	if (ttl > LORAL2_MESH_MAX_TTL) ttl = LORAL2_MESH_MAX_TTL;
+
+	size_t len = LORAL2_MESH_HDR_LEN + payload_len;
+	uint8_t *buffer = (uint8_t*) malloc(len);
+	buffer[0] = ttl;
+	buffer[1] = arduino_random(0, 256);
+	buffer[2] = arduino_random(0, 256);
+	memcpy(buffer + LORAL2_MESH_HDR_LEN, packet, payload_len);
+
+	bool ok = l2->send(buffer, len);
+	if (ok) {
+		// so that relays of our own message are dropped
+		dedup.seen(buffer + 1, len - 1, arduino_millis());
+	}
+	free(buffer);
+	return ok;
+}
+
+size_t LoRaL2Mesh::poll()
+{
+	size_t count = l2->poll();
+	send_due();
+	return count;
+}
+
+void LoRaL2Mesh::recv(LoRaL2Packet *pkt)
+{
+	if (pkt->err) {
+		observer->recv(pkt);
+		return;
+	}
+	if (pkt->len < LORAL2_MESH_HDR_LEN) {
+		pkt->err = MESH_ERR_SHORT;
+		observer->recv(pkt);
+		return;
+	}
+
+	// TTL and hops change along the way, message id and payload do not
+	const uint8_t *id = pkt->packet + 1;
+	size_t id_len = pkt->len - 1;
+	if (dedup.seen(id, id_len, arduino_millis())) {
+		++n_duplicates;
+		heard_again(LoRaL2Dedup::hash(id, id_len));
+		delete pkt;
+		return;
+	}
+
+	int ttl = pkt->packet[0] & 0x0f;
+	if (ttl > 0) {
+		schedule_relay(pkt->packet, pkt->len, pkt->rssi,
+				LoRaL2Dedup::hash(id, id_len));
+	}
+
+	pkt->len -= LORAL2_MESH_HDR_LEN;
+	memmove(pkt->packet, pkt->packet + LORAL2_MESH_HDR_LEN, pkt->len);
+	observer->recv(pkt);
+}
+
+// Relay delay in slots: 0 at -120 dBm or below, 10 at -20 dBm or above
+uint32_t LoRaL2Mesh::relay_step(int rssi)
+{
+	int step = (rssi + 120) / 10;
+	if (step < 0) step = 0;
+	if (step > 10) step = 10;
+	return step;
+}
+
+void LoRaL2Mesh::schedule_relay(const uint8_t *packet, size_t len, int rssi, uint32_t hash)
+{
+	Pending *p = 0;
+	for (size_t i = 0; i < LORAL2_MESH_PENDING; ++i) {
+		if (!pending[i].packet) {
+			p = &pending[i];
+			break;
+		}
+	}
+	if (!p) {
+		++n_dropped;
+		return;
+	}
+
+	int ttl = packet[0] & 0x0f;
+	int hops = packet[0] >> 4;
+	if (hops < LORAL2_MESH_MAX_TTL) ++hops;
+
+	p->packet = (uint8_t*) malloc(len);
+	memcpy(p->packet, packet, len);
+	p->packet[0] = (hops << 4) | (ttl - 1);
+	p->len = len;
+	p->hash = hash;
+	p->copies = 0;
+
+	uint32_t slot = l2->airtime_us(len) / 1000 + SLOT_GUARD_MS;
+	p->due = arduino_millis() + relay_step(rssi) * slot + arduino_random(0, slot);
+}
+
+void LoRaL2Mesh::heard_again(uint32_t hash)
+{
+	for (size_t i = 0; i < LORAL2_MESH_PENDING; ++i) {
+		Pending &p = pending[i];
+		if (p.packet && p.hash == hash && ++p.copies >= suppress) {
+			free(p.packet);
+			p.packet = 0;
+			++n_cancelled;
+		}
+	}
+}
+
+bool LoRaL2Mesh::airtime_ok(uint32_t us, uint32_t now)
+{
+	if ((now - window_start) >= CAP_WINDOW_MS) {
+		window_start = now;
+		window_used_us = 0;
+	}
+	// permille of the window in ms is the budget in us
+	if (window_used_us + us > cap_permille * CAP_WINDOW_MS) {
+		return false;
+	}
+	window_used_us += us;
+	return true;
+}
+
+void LoRaL2Mesh::send_due()
+{
+	uint32_t now = arduino_millis();
+	for (size_t i = 0; i < LORAL2_MESH_PENDING; ++i) {
+		Pending &p = pending[i];
+		if (!p.packet || (int32_t) (now - p.due) < 0) {
+			continue;
+		}
+		uint32_t us = l2->airtime_us(p.len);
+		if (!airtime_ok(us, now)) {
+			++n_dropped;
+		} else if (l2->send(p.packet, p.len)) {
+			++n_relayed;
+		} else {
+			// radio busy, retry on next poll
+			window_used_us -= us;
+			continue;
+		}
+		free(p.packet);
+		p.packet = 0;
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Managed flooding on top of LoRaL2. Every node relays what it hears,
+// at most TTL times per message, and drops what it has already heard.
+// Relays are delayed in proportion to the RSSI, so the most distant
+// receivers (weakest signal, largest new coverage) go first; a pending
+// relay is cancelled when the same message is heard from someone else.
+// Relay airtime is capped per node, as a duty cycle.
+//
+// Each payload carries a 3-octet header: TTL (low nibble) and hop
+// count (high nibble), then a random 16-bit message id.
+
+#ifndef __MESH_H
+#define __MESH_H
+
+#include <cstddef>
+#include <cinttypes>
+#include "LoRaL2.h"
+#include "Dedup.h"
+
+#define LORAL2_MESH_HDR_LEN 3
+#define LORAL2_MESH_MAX_TTL 15
+
+#ifndef LORAL2_MESH_TTL
+#define LORAL2_MESH_TTL 3
+#endif
+
+// Relays waiting for their time slot
+#ifndef LORAL2_MESH_PENDING
+#define LORAL2_MESH_PENDING 8
+#endif
+
+// How long a message is remembered, to drop copies of it
+#ifndef LORAL2_MESH_DEDUP_MS
+#define LORAL2_MESH_DEDUP_MS 30000
+#endif
+
+// Frame too short for the mesh header
+#define MESH_ERR_SHORT 1101
+
+class LoRaL2Mesh: public LoRaL2Observer {
+public:
+	LoRaL2Mesh(const LoRaL2Mesh&) = delete;
+	void operator=(const LoRaL2Mesh&) = delete;
+
+	// Same parameters as LoRaL2; observer receives packets without
+	// the mesh header. Radio must outlive the mesh.
+	LoRaL2Mesh(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, LoRaL2Observer *observer);
+	virtual ~LoRaL2Mesh();
+
+	// ttl is the number of times the message may be relayed
+	bool send(const uint8_t *packet, size_t payload_len, int ttl = LORAL2_MESH_TTL);
+	size_t max_payload() const;
+	// Must be called often (e.g. from loop()): receives, and sends
+	// relays whose time has come. Returns frames processed.
+	size_t poll();
+	LoRaL2 *link();
+
+	// Relay airtime budget, in permille of a 60-second window
+	// (default 10, i.e. 1% duty cycle). Relays over budget are dropped.
+	void set_airtime_cap(uint32_t permille);
+	// Copies of a message heard from others that cancel our relay
+	// (default 1)
+	void set_suppress(int copies);
+
+	uint32_t relayed() const;
+	uint32_t relays_cancelled() const;
+	uint32_t relays_dropped() const;
+	uint32_t duplicates() const;
+
+	virtual void recv(LoRaL2Packet *pkt);
+
+	/* private */
+	struct Pending {
+		uint8_t *packet;	// NULL if slot is free
+		size_t len;
+		uint32_t hash;
+		uint32_t due;
+		int copies;
+	};
+
+	void schedule_relay(const uint8_t *packet, size_t len, int rssi, uint32_t hash);
+	void heard_again(uint32_t hash);
+	bool airtime_ok(uint32_t us, uint32_t now);
+	void send_due();
+	static uint32_t relay_step(int rssi);
+
+	LoRaL2 *l2;
+	LoRaL2Observer *observer;
+	LoRaL2Dedup dedup;
+	Pending pending[LORAL2_MESH_PENDING];
+	uint32_t cap_permille;
+	uint32_t window_start;
+	uint32_t window_used_us;
+	int suppress;
+	uint32_t n_relayed;
+	uint32_t n_cancelled;
+	uint32_t n_dropped;
+	uint32_t n_duplicates;
+};
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "Radio.h"
 #include "LoRaL2.h"
+#include "ArduinoBridge.h"
 
 #ifndef __AVR__
 #include <SPI.h>
@@ -31,61 +32,203 @@
 
 #endif
 
-static LoRaL2* observer;
+// LoRa library callbacks have no context argument, so each radio
+// gets a slot and a pair of trampolines bound to it.
 
+#if LORAL2_MAX_RADIOS > 4
+#error "LORAL2_MAX_RADIOS > 4 needs more trampolines"
+#endif
+
+static RadioSX127x* radios[LORAL2_MAX_RADIOS];
+
+template <int N>
 static void on_recv_trampoline(int len)
 {
-	uint8_t *buffer = (uint8_t*) calloc(len, sizeof(char));
+	// as close to the DIO0 interrupt as the LoRa library lets us get
+	uint32_t now = arduino_micros();
+	radios[N]->on_recv(len, now);
+}
+
+template <int N>
+static void on_sent_trampoline()
+{
+	radios[N]->on_sent();
+}
+
+static void (* const recv_trampolines[])(int) = {
+	on_recv_trampoline<0>, on_recv_trampoline<1>,
+#if LORAL2_MAX_RADIOS > 2
+	on_recv_trampoline<2>, on_recv_trampoline<3>,
+#endif
+};
+
+static void (* const sent_trampolines[])() = {
+	on_sent_trampoline<0>, on_sent_trampoline<1>,
+#if LORAL2_MAX_RADIOS > 2
+	on_sent_trampoline<2>, on_sent_trampoline<3>,
+#endif
+};
+
+RadioSX127x::RadioSX127x(): RadioSX127x(&LoRa, &SPI, SS, RST, DIO0)
+{
+}
+
+// Note: the stock LoRa library routes the DIO0 interrupt to the global
+// LoRa object only. Other LoRaClass instances need a library version
+// with per-instance interrupt handling.
+RadioSX127x::RadioSX127x(LoRaClass *lora, SPIClass *spi, int ss, int rst, int dio0)
+{
+	this->lora = lora;
+	this->spi = spi;
+	this->ss = ss;
+	this->rst = rst;
+	this->dio0 = dio0;
+	this->observer = 0;
+	this->slot = -1;
+}
+
+RadioSX127x::~RadioSX127x()
+{
+	if (slot >= 0) {
+		lora->end();
+		radios[slot] = 0;
+	}
+}
 
-	int rssi = LoRa.packetRssi();
-	for (size_t i = 0; i < len; i++) {
-		buffer[i] = LoRa.read();
+void RadioSX127x::on_recv(int len, uint32_t time_us)
+{
+	LoRaL2RxInfo info;
+	info.rssi = lora->packetRssi();
+	info.snr = lora->packetSnr();
+	info.freq_error = lora->packetFrequencyError();
+	info.time_us = time_us;
+
+	if (observer->deferred_rx()) {
+		// just copy the frame, LoRaL2::poll() does the heavy lifting
+		uint8_t *slot = observer->on_recv_slot();
+		if (slot) {
+			read(slot, len);
+			observer->on_recv_commit(info, len);
+		}
+		return;
 	}
 
-	observer->on_recv(rssi, buffer, len);
+	uint8_t *buffer = (uint8_t*) calloc(len, sizeof(char));
+	read(buffer, len);
+
+	observer->on_recv(info, buffer, len);
 }
 
-static void on_sent_trampoline()
+void RadioSX127x::on_sent()
 {
 	observer->on_sent();
 }
 
-bool lora_start(long int band, int spread, int bandwidth, int power, int paboost,
-		int cr4slsh, LoRaL2 *pobserver)
+bool RadioSX127x::start(long int band, int spread, int bandwidth, int power,
+		int paboost, int cr4slsh, LoRaL2 *pobserver)
 {
+	if (slot < 0) {
+		for (int i = 0; i < LORAL2_MAX_RADIOS; ++i) {
+			if (!radios[i]) {
+				slot = i;
+				radios[i] = this;
+				break;
+			}
+		}
+		if (slot < 0) {
+			return false;
+		}
+	}
+
 #ifndef __AVR__
-	SPI.begin(SCK, MISO, MOSI, SS);
+	if (spi == &SPI) {
+		SPI.begin(SCK, MISO, MOSI, ss);
+	}
 #endif
-	LoRa.setPins(SS, RST, DIO0);
+	lora->setSPI(*spi);
+	lora->setPins(ss, rst, dio0);
 
-	if (!LoRa.begin(band)) {
+	if (!lora->begin(band)) {
 		return false;
 	}
 
-	LoRa.setTxPower(power, paboost);
-	LoRa.setSpreadingFactor(spread);
-	LoRa.setSignalBandwidth(bandwidth);
-	LoRa.setCodingRate4(cr4slsh);
-	LoRa.disableCrc();
-	LoRa.onReceive(on_recv_trampoline);
-	LoRa.onTxDone(on_sent_trampoline);
+	lora->setTxPower(power, paboost);
+	lora->setSpreadingFactor(spread);
+	lora->setSignalBandwidth(bandwidth);
+	lora->setCodingRate4(cr4slsh);
+	lora->disableCrc();
+	lora->onReceive(recv_trampolines[slot]);
+	lora->onTxDone(sent_trampolines[slot]);
 	
 	observer = pobserver;
 	return true;
 }
 
-void lora_receive()
+void RadioSX127x::receive()
+{
+	lora->receive();
+}
+
+bool RadioSX127x::begin_packet()
 {
-	LoRa.receive();
+	return lora->beginPacket();
 }
 
-bool lora_begin_packet()
+// LoRa.read() and LoRa.write() do one SPI transaction per octet.
+// The FIFO register auto-increments the FIFO pointer, so the whole
+// frame can go in a single transaction.
+
+#define REG_FIFO           0x00
+#define REG_PAYLOAD_LENGTH 0x22
+
+static SPISettings fifo_spi_settings(LORA_DEFAULT_SPI_FREQUENCY, MSBFIRST, SPI_MODE0);
+
+// LoRa library has already pointed the FIFO to the received frame
+// when on_recv() is called
+void RadioSX127x::read(uint8_t* buffer, size_t len)
+{
+	memset(buffer, 0, len);
+	spi->beginTransaction(fifo_spi_settings);
+	digitalWrite(ss, LOW);
+	spi->transfer(REG_FIFO & 0x7f);
+	spi->transfer(buffer, len);
+	digitalWrite(ss, HIGH);
+	spi->endTransaction();
+}
+
+// LoRa.beginPacket() has pointed the FIFO to the TX base address
+void RadioSX127x::finish_packet_sg(const RadioFrag* frags, size_t count)
 {
-	return LoRa.beginPacket();
+	size_t len = 0;
+
+	spi->beginTransaction(fifo_spi_settings);
+	digitalWrite(ss, LOW);
+	spi->transfer(REG_FIFO | 0x80);
+	for (size_t i = 0; i < count; ++i) {
+#if defined(ESP32)
+		spi->writeBytes(frags[i].data, frags[i].len);
+#else
+		for (size_t j = 0; j < frags[i].len; ++j) {
+			spi->transfer(frags[i].data[j]);
+		}
+#endif
+		len += frags[i].len;
+	}
+	digitalWrite(ss, HIGH);
+	spi->endTransaction();
+
+	// done by LoRa.write() when it writes the FIFO itself
+	spi_write_reg(REG_PAYLOAD_LENGTH, len);
+
+	lora->endPacket(true);
 }
 
-void lora_finish_packet(const uint8_t* packet, size_t len)
+void RadioSX127x::spi_write_reg(uint8_t reg, uint8_t value)
 {
-	LoRa.write(packet, len);
-	LoRa.endPacket(true);
+	spi->beginTransaction(fifo_spi_settings);
+	digitalWrite(ss, LOW);
+	spi->transfer(reg | 0x80);
+	spi->transfer(value);
+	digitalWrite(ss, HIGH);
+	spi->endTransaction();
 }
@@ -11,10 +11,80 @@
 
 class LoRaL2;
 
-bool lora_start(long int band, int spread, int bandwidth, int power,
-		int paboost, int cr4slsh, LoRaL2 *pobserver);
-void lora_receive();
-bool lora_begin_packet();
-void lora_finish_packet(const uint8_t* packet, size_t len);
+// Fragment of a frame to be transmitted
+struct RadioFrag {
+	const uint8_t* data;
+	size_t len;
+};
+
+// Radio driver interface. Each LoRaL2 instance talks to its own driver,
+// so a process may host several radio + stack pairs.
+class RadioDriver {
+public:
+	virtual ~RadioDriver() {};
+
+	virtual bool start(long int band, int spread, int bandwidth, int power,
+			int paboost, int cr4slsh, LoRaL2 *observer) = 0;
+	virtual void receive() = 0;
+	virtual bool begin_packet() = 0;
+
+	// Burst read of the received frame from radio FIFO into caller memory
+	virtual void read(uint8_t* buffer, size_t len) = 0;
+
+	// Streams the fragments into radio FIFO, in order, and transmits them
+	// as a single frame
+	virtual void finish_packet_sg(const RadioFrag* frags, size_t count) = 0;
+
+	void finish_packet(const uint8_t* packet, size_t len)
+	{
+		RadioFrag frag = {packet, len};
+		finish_packet_sg(&frag, 1);
+	}
+};
+
+#ifdef ARDUINO
+
+class LoRaClass;
+class SPIClass;
+
+// Maximum number of SX127x radios, limited by the number of
+// callback trampolines (LoRa library callbacks carry no context)
+#ifndef LORAL2_MAX_RADIOS
+#define LORAL2_MAX_RADIOS 2
+#endif
+
+// SX127x driver on top of the LoRa library. The default constructor
+// uses the global LoRa and SPI objects, wired as in Heltec WiFi LoRa 32.
+class RadioSX127x: public RadioDriver {
+public:
+	RadioSX127x(const RadioSX127x&) = delete;
+	void operator=(const RadioSX127x&) = delete;
+
+	RadioSX127x();
+	RadioSX127x(LoRaClass *lora, SPIClass *spi, int ss, int rst, int dio0);
+	virtual ~RadioSX127x();
+
+	virtual bool start(long int band, int spread, int bandwidth, int power,
+			int paboost, int cr4slsh, LoRaL2 *observer);
+	virtual void receive();
+	virtual bool begin_packet();
+	virtual void read(uint8_t* buffer, size_t len);
+	virtual void finish_packet_sg(const RadioFrag* frags, size_t count);
+
+	/* private */
+	void on_recv(int len, uint32_t time_us);
+	void on_sent();
+	void spi_write_reg(uint8_t reg, uint8_t value);
+
+	LoRaClass *lora;
+	SPIClass *spi;
+	int ss;
+	int rst;
+	int dio0;
+	int slot;
+	LoRaL2 *observer;
+};
+
+#endif
 
 #endif
@@ -0,0 +1,359 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ArduinoBridge.h"
+#include "Router.h"
+
+// Frame type, high nibble of the first octet. The low nibble is the
+// hop count of unicast frames.
+#define TYPE_BEACON 0
+#define TYPE_DATA 1
+
+// Beacon: type, source, then destination, next hop and metric per route
+#define BEACON_HDR_LEN 3
+#define BEACON_ENTRY_LEN 5
+
+static uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+LoRaL2Router::LoRaL2Router(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, uint16_t address,
+		LoRaL2RouterObserver *observer)
+{
+	this->observer = observer;
+	this->addr = address;
+	count = 0;
+	memset(queue, 0, sizeof(queue));
+	beacon_interval = LORAL2_ROUTE_BEACON_MS;
+	next_beacon = arduino_millis() + arduino_random(0, beacon_interval / 4 + 1);
+	n_beacons = n_beacon_octets = n_forwarded = n_no_route = 0;
+
+	l2 = new LoRaL2(radio, band, spread, bandwidth, key, key_len, this);
+	// frames are handled in poll(), where they may be forwarded
+	l2->set_deferred_rx(true);
+}
+
+LoRaL2Router::~LoRaL2Router()
+{
+	delete l2;
+	for (size_t i = 0; i < LORAL2_ROUTE_QUEUE; ++i) {
+		free(queue[i].packet);
+	}
+}
+
+LoRaL2 *LoRaL2Router::link()
+{
+	return l2;
+}
+
+uint16_t LoRaL2Router::address() const
+{
+	return addr;
+}
+
+size_t LoRaL2Router::max_payload() const
+{
+	return l2->max_payload() - LORAL2_ROUTE_HDR_LEN;
+}
+
+void LoRaL2Router::set_beacon_interval(uint32_t ms)
+{
+	beacon_interval = ms;
+	next_beacon = arduino_millis() + arduino_random(0, ms / 4 + 1);
+}
+
+size_t LoRaL2Router::routes() const
+{
+	return count;
+}
+
+bool LoRaL2Router::route(uint16_t dst, uint16_t &next, int &metric) const
+{
+	const Route *r = find(dst);
+	if (!r) {
+		return false;
+	}
+	next = r->next;
+	metric = r->metric;
+	return true;
+}
+
+uint32_t LoRaL2Router::beacons() const
+{
+	return n_beacons;
+}
+
+uint32_t LoRaL2Router::beacon_octets() const
+{
+	return n_beacon_octets;
+}
+
+uint32_t LoRaL2Router::forwarded() const
+{
+	return n_forwarded;
+}
+
+uint32_t LoRaL2Router::no_route() const
+{
+	return n_no_route;
+}
+
+// First entry whose destination is not less than dst
+size_t LoRaL2Router::lower_bound(uint16_t dst) const
+{
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (table[mid].dst < dst) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+const LoRaL2Router::Route *LoRaL2Router::find(uint16_t dst) const
+{
+	size_t i = lower_bound(dst);
+	return (i < count && table[i].dst == dst) ? &table[i] : 0;
+}
+
+void LoRaL2Router::remove(size_t i)
+{
+	memmove(&table[i], &table[i + 1], (count - i - 1) * sizeof(Route));
+	--count;
+}
+
+void LoRaL2Router::learn(uint16_t dst, uint16_t next, int metric, uint32_t now)
+{
+	if (dst == addr || dst == LORAL2_ROUTE_NONE) {
+		return;
+	}
+	if (metric > LORAL2_ROUTE_INFINITY) {
+		metric = LORAL2_ROUTE_INFINITY;
+	}
+
+	size_t i = lower_bound(dst);
+	if (i < count && table[i].dst == dst) {
+		Route &r = table[i];
+		if (r.next == next) {
+			// news from the current next hop are always accepted
+			if (metric >= LORAL2_ROUTE_INFINITY) {
+				remove(i);
+			} else {
+				r.metric = metric;
+				r.updated = now;
+			}
+		} else if (metric < r.metric) {
+			r.next = next;
+			r.metric = metric;
+			r.updated = now;
+		}
+		return;
+	}
+
+	if (metric >= LORAL2_ROUTE_INFINITY || count >= LORAL2_ROUTES) {
+		return;
+	}
+	memmove(&table[i + 1], &table[i], (count - i) * sizeof(Route));
+	table[i].dst = dst;
+	table[i].next = next;
+	table[i].metric = metric;
+	table[i].updated = now;
+	++count;
+}
+
+void LoRaL2Router::expire(uint32_t now)
+{
+	uint32_t max_age = beacon_interval * LORAL2_ROUTE_MAX_AGE;
+	for (size_t i = 0; i < count; ) {
+		if ((now - table[i].updated) > max_age) {
+			remove(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+void LoRaL2Router::recv(LoRaL2Packet *pkt)
+{
+	// corrupted frames cannot be attributed to anybody
+	if (pkt->err || pkt->len < 1) {
+		delete pkt;
+		return;
+	}
+
+	uint32_t now = arduino_millis();
+	int type = pkt->packet[0] >> 4;
+	if (type == TYPE_DATA && pkt->len >= LORAL2_ROUTE_HDR_LEN) {
+		recv_data(pkt, now);
+		return;
+	}
+	if (type == TYPE_BEACON && pkt->len >= BEACON_HDR_LEN) {
+		recv_beacon(pkt->packet, pkt->len, now);
+	}
+	delete pkt;
+}
+
+void LoRaL2Router::recv_beacon(const uint8_t *packet, size_t len, uint32_t now)
+{
+	uint16_t src = get16(packet + 1);
+	if (src == addr) {
+		return;
+	}
+	learn(src, src, 1, now);
+	for (size_t i = BEACON_HDR_LEN; i + BEACON_ENTRY_LEN <= len; i += BEACON_ENTRY_LEN) {
+		// split horizon: a route through us is of no use to us, and
+		// would keep dead routes alive by counting to infinity
+		if (get16(packet + i + 2) != addr) {
+			learn(get16(packet + i), src, packet[i + 4] + 1, now);
+		}
+	}
+}
+
+void LoRaL2Router::recv_data(LoRaL2Packet *pkt, uint32_t now)
+{
+	uint8_t *p = pkt->packet;
+	int hops = p[0] & 0x0f;
+	uint16_t dst = get16(p + 1);
+	uint16_t src = get16(p + 3);
+	uint16_t next = get16(p + 5);
+	uint16_t via = get16(p + 7);
+
+	if (src == addr || via == addr) {
+		delete pkt;
+		return;
+	}
+
+	// overheard traffic is as good as a beacon
+	learn(via, via, 1, now);
+	learn(src, via, hops + 1, now);
+
+	if (next != addr) {
+		delete pkt;
+		return;
+	}
+
+	if (dst == addr) {
+		pkt->len -= LORAL2_ROUTE_HDR_LEN;
+		memmove(p, p + LORAL2_ROUTE_HDR_LEN, pkt->len);
+		observer->recv(src, pkt);
+		return;
+	}
+
+	const Route *r = find(dst);
+	if (!r || hops + 1 >= LORAL2_ROUTE_INFINITY) {
+		++n_no_route;
+		delete pkt;
+		return;
+	}
+	p[0] = (TYPE_DATA << 4) | (hops + 1);
+	put16(p + 5, r->next);
+	put16(p + 7, addr);
+	if (transmit(p, pkt->len)) {
+		++n_forwarded;
+	}
+	delete pkt;
+}
+
+bool LoRaL2Router::send(uint16_t dst, const uint8_t *packet, size_t payload_len)
+{
+	if (payload_len > max_payload()) {
+		return false;
+	}
+	const Route *r = find(dst);
+	if (!r) {
+		++n_no_route;
+		return false;
+	}
+
+	size_t len = LORAL2_ROUTE_HDR_LEN + payload_len;
+	uint8_t *buffer = (uint8_t*) malloc(len);
+	buffer[0] = TYPE_DATA << 4;
+	put16(buffer + 1, dst);
+	put16(buffer + 3, addr);
+	put16(buffer + 5, r->next);
+	put16(buffer + 7, addr);
+	memcpy(buffer + LORAL2_ROUTE_HDR_LEN, packet, payload_len);
+
+	bool ok = transmit(buffer, len);
+	free(buffer);
+	return ok;
+}
+
+void LoRaL2Router::send_beacon()
+{
+	size_t max_len = l2->max_payload();
+	uint8_t *buffer = (uint8_t*) malloc(max_len);
+	buffer[0] = TYPE_BEACON << 4;
+	put16(buffer + 1, addr);
+
+	size_t len = BEACON_HDR_LEN;
+	for (size_t i = 0; i < count && len + BEACON_ENTRY_LEN <= max_len; ++i) {
+		put16(buffer + len, table[i].dst);
+		put16(buffer + len + 2, table[i].next);
+		buffer[len + 4] = table[i].metric;
+		len += BEACON_ENTRY_LEN;
+	}
+
+	if (transmit(buffer, len)) {
+		++n_beacons;
+		n_beacon_octets += l2->frame_len(len);
+	}
+	free(buffer);
+}
+
+// Sends now, or queues if the radio is busy
+bool LoRaL2Router::transmit(const uint8_t *packet, size_t len)
+{
+	if (l2->send(packet, len)) {
+		return true;
+	}
+	for (size_t i = 0; i < LORAL2_ROUTE_QUEUE; ++i) {
+		if (!queue[i].packet) {
+			queue[i].packet = (uint8_t*) malloc(len);
+			memcpy(queue[i].packet, packet, len);
+			queue[i].len = len;
+			return true;
+		}
+	}
+	return false;
+}
+
+void LoRaL2Router::send_queued()
+{
+	for (size_t i = 0; i < LORAL2_ROUTE_QUEUE; ++i) {
+		if (queue[i].packet && l2->send(queue[i].packet, queue[i].len)) {
+			free(queue[i].packet);
+			queue[i].packet = 0;
+		}
+	}
+}
+
+size_t LoRaL2Router::poll()
+{
+	size_t frames = l2->poll();
+	uint32_t now = arduino_millis();
+
+	expire(now);
+	send_queued();
+	if ((int32_t) (now - next_beacon) >= 0) {
+		send_beacon();
+		next_beacon = now + beacon_interval + arduino_random(0, beacon_interval / 4 + 1);
+	}
+	return frames;
+}
@@ -0,0 +1,129 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Distance-vector routing for unicast multi-hop delivery, on top of
+// LoRaL2. Nodes broadcast their routing table in periodic beacons, and
+// also learn routes from overheard traffic. Unicast frames name their
+// next hop, so only the nodes along the best path forward them.
+//
+// The routing table is fixed-size and sorted by destination, so the
+// lookup on the RX path is a binary search. Metric is the hop count;
+// beacons carry the next hop of each route, for split horizon, and
+// routes not refreshed for LORAL2_ROUTE_MAX_AGE beacon intervals expire.
+
+#ifndef __ROUTER_H
+#define __ROUTER_H
+
+#include <cstddef>
+#include <cinttypes>
+#include "LoRaL2.h"
+
+#ifndef LORAL2_ROUTES
+#define LORAL2_ROUTES 32
+#endif
+
+// Frames waiting for the radio to be free
+#ifndef LORAL2_ROUTE_QUEUE
+#define LORAL2_ROUTE_QUEUE 4
+#endif
+
+#ifndef LORAL2_ROUTE_BEACON_MS
+#define LORAL2_ROUTE_BEACON_MS 30000
+#endif
+
+// in beacon intervals
+#ifndef LORAL2_ROUTE_MAX_AGE
+#define LORAL2_ROUTE_MAX_AGE 3
+#endif
+
+// Unreachable; also the hop limit of unicast frames
+#define LORAL2_ROUTE_INFINITY 15
+
+// type and hop count, destination, source, next hop, transmitter
+#define LORAL2_ROUTE_HDR_LEN 9
+
+#define LORAL2_ROUTE_NONE 0xffff
+
+class LoRaL2RouterObserver {
+public:
+	// Unicast payload sent by src to this node
+	virtual void recv(uint16_t src, LoRaL2Packet*) = 0;
+	virtual ~LoRaL2RouterObserver() {};
+};
+
+class LoRaL2Router: public LoRaL2Observer {
+public:
+	LoRaL2Router(const LoRaL2Router&) = delete;
+	void operator=(const LoRaL2Router&) = delete;
+
+	// Same parameters as LoRaL2, plus the address of this node
+	// (any value but LORAL2_ROUTE_NONE). Radio must outlive the router.
+	LoRaL2Router(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, uint16_t address,
+		LoRaL2RouterObserver *observer);
+	virtual ~LoRaL2Router();
+
+	// Fails if there is no route to dst
+	bool send(uint16_t dst, const uint8_t *packet, size_t payload_len);
+	size_t max_payload() const;
+	// Must be called often (e.g. from loop()): receives, forwards,
+	// sends beacons and expires routes. Returns frames processed.
+	size_t poll();
+	LoRaL2 *link();
+	uint16_t address() const;
+
+	void set_beacon_interval(uint32_t ms);
+
+	// Routing table inspection
+	size_t routes() const;
+	bool route(uint16_t dst, uint16_t &next, int &metric) const;
+
+	// Counters, to measure convergence and overhead
+	uint32_t beacons() const;
+	uint32_t beacon_octets() const;	// on air, FEC included
+	uint32_t forwarded() const;
+	uint32_t no_route() const;
+
+	virtual void recv(LoRaL2Packet *pkt);
+
+	/* private */
+	struct Route {
+		uint16_t dst;
+		uint16_t next;
+		uint8_t metric;
+		uint32_t updated;
+	};
+
+	struct Queued {
+		uint8_t *packet;	// NULL if slot is free
+		size_t len;
+	};
+
+	const Route *find(uint16_t dst) const;
+	size_t lower_bound(uint16_t dst) const;
+	void learn(uint16_t dst, uint16_t next, int metric, uint32_t now);
+	void remove(size_t i);
+	void expire(uint32_t now);
+	void recv_beacon(const uint8_t *packet, size_t len, uint32_t now);
+	void recv_data(LoRaL2Packet *pkt, uint32_t now);
+	void send_beacon();
+	bool transmit(const uint8_t *packet, size_t len);
+	void send_queued();
+
+	LoRaL2 *l2;
+	LoRaL2RouterObserver *observer;
+	uint16_t addr;
+	Route table[LORAL2_ROUTES];
+	size_t count;
+	Queued queue[LORAL2_ROUTE_QUEUE];
+	uint32_t beacon_interval;
+	uint32_t next_beacon;
+	uint32_t n_beacons;
+	uint32_t n_beacon_octets;
+	uint32_t n_forwarded;
+	uint32_t n_no_route;
+};
+
+#endif
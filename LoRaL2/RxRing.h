@@ -0,0 +1,97 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Lock-free single-producer/single-consumer rings. No allocation after
+// construction. The raw frame ring is fed by the radio RX callback
+// (interrupt context) and consumed by LoRaL2::poll() or the worker task.
+
+#ifndef __RXRING_H
+#define __RXRING_H
+
+#include <cinttypes>
+#include <cstddef>
+#include "LoRaL2.h"
+
+#ifndef LORAL2_RX_SLOTS
+#define LORAL2_RX_SLOTS 4	// must be a power of 2
+#endif
+
+// Maximum LoRa frame size
+#define LORAL2_MAX_FRAME 255
+
+template <typename T, uint32_t N>
+class LoRaL2Spsc {
+public:
+	LoRaL2Spsc(const LoRaL2Spsc&) = delete;
+	void operator=(const LoRaL2Spsc&) = delete;
+
+	LoRaL2Spsc(): head(0), tail(0), dropped(0) {}
+
+	// Producer: returns a free slot, or NULL if ring is full
+	// (in which case the item is counted as dropped)
+	T* claim() {
+		uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		uint32_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+		if ((h - t) >= N) {
+			__atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		return &slots[h % N];
+	}
+
+	// Producer: makes the slot returned by claim() visible to consumer
+	void publish() {
+		uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+	}
+
+	// Consumer: oldest item, or NULL if ring is empty
+	T* peek() {
+		uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		if (h == t) {
+			return 0;
+		}
+		return &slots[t % N];
+	}
+
+	// Consumer: gives the slot returned by peek() back to producer
+	void release() {
+		uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		__atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+	}
+
+	uint32_t drop_count() const {
+		return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	}
+
+private:
+	T slots[N];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+};
+
+struct LoRaL2RawFrame {
+	uint8_t buf[LORAL2_MAX_FRAME];
+	size_t len;
+	LoRaL2RxInfo info;
+};
+
+class LoRaL2RxRing: public LoRaL2Spsc<LoRaL2RawFrame, LORAL2_RX_SLOTS> {};
+
+// Finished packets, from worker task to poll()
+struct LoRaL2DecodedFrame {
+	uint8_t buf[LORAL2_MAX_FRAME];
+	size_t len;
+	LoRaL2Meta meta;
+};
+
+class LoRaL2PacketQueue: public LoRaL2Spsc<LoRaL2DecodedFrame, LORAL2_RX_SLOTS> {};
+
+// Send completions, from radio callback to poll()
+class LoRaL2TxReportQueue: public LoRaL2Spsc<LoRaL2TxReport, LORAL2_RX_SLOTS> {};
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ArduinoBridge.h"
+#include "Tdma.h"
+
+#define TYPE_BEACON 0
+#define TYPE_DATA 1
+
+static uint32_t get32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+LoRaL2Tdma::LoRaL2Tdma(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, int slot, LoRaL2Observer *observer)
+{
+	this->observer = observer;
+	this->spread = spread;
+	this->bandwidth = bandwidth;
+	this->slot = slot;
+	coordinator = false;
+	is_synced = false;
+	offset = 0;
+	last_beacon = next_beacon = 0;
+	slots = 0;
+	slot_len = beacon_slot_len = guard = superframe = 0;
+	slot_used = false;
+	last_slot = 0;
+	memset(queue, 0, sizeof(queue));
+	head = count = 0;
+	n_beacons = n_sent = n_dropped = 0;
+
+	l2 = new LoRaL2(radio, band, spread, bandwidth, key, key_len, this);
+	// packets are handled in poll(), where beacons and slots are timed
+	l2->set_deferred_rx(true);
+}
+
+LoRaL2Tdma::~LoRaL2Tdma()
+{
+	delete l2;
+	while (count) {
+		pop();
+	}
+}
+
+LoRaL2 *LoRaL2Tdma::link()
+{
+	return l2;
+}
+
+size_t LoRaL2Tdma::max_payload() const
+{
+	return l2->max_payload() - LORAL2_TDMA_HDR_LEN;
+}
+
+bool LoRaL2Tdma::synced() const
+{
+	return is_synced;
+}
+
+uint32_t LoRaL2Tdma::network_us() const
+{
+	return arduino_micros() + offset;
+}
+
+uint32_t LoRaL2Tdma::superframe_us() const
+{
+	return superframe;
+}
+
+uint32_t LoRaL2Tdma::guard_us() const
+{
+	return guard;
+}
+
+uint32_t LoRaL2Tdma::beacons() const
+{
+	return n_beacons;
+}
+
+uint32_t LoRaL2Tdma::sent() const
+{
+	return n_sent;
+}
+
+uint32_t LoRaL2Tdma::dropped() const
+{
+	return n_dropped;
+}
+
+bool LoRaL2Tdma::set_coordinator(int slots, size_t payload_len)
+{
+	if (slots < 1 || slots > LORAL2_TDMA_MAX_SLOTS) {
+		return false;
+	}
+	uint32_t data_air = l2->airtime_us(LORAL2_TDMA_HDR_LEN + payload_len);
+	uint32_t beacon_air = l2->airtime_us(LORAL2_TDMA_BEACON_LEN);
+	uint32_t symbol_us = (1UL << spread) * 1000000ULL / bandwidth;
+	// drift is small, estimated over a superframe without guards
+	uint64_t estimate = beacon_air + (uint64_t) slots * (data_air + LORAL2_TDMA_TX_WINDOW_US);
+
+	this->coordinator = true;
+	this->slots = slots;
+	guard = LORAL2_TDMA_GUARD_SYMBOLS * symbol_us +
+		2 * LORAL2_TDMA_DRIFT_PPM * estimate / 1000000;
+	slot_len = data_air + guard + LORAL2_TDMA_TX_WINDOW_US;
+	beacon_slot_len = beacon_air + guard;
+	superframe = beacon_slot_len + slots * slot_len;
+	offset = 0;
+	is_synced = true;
+	next_beacon = network_us();
+	return true;
+}
+
+bool LoRaL2Tdma::send(const uint8_t *packet, size_t payload_len)
+{
+	if (payload_len > max_payload() || count >= LORAL2_TDMA_QUEUE) {
+		++n_dropped;
+		return false;
+	}
+	Queued &q = queue[(head + count) % LORAL2_TDMA_QUEUE];
+	q.len = LORAL2_TDMA_HDR_LEN + payload_len;
+	q.packet = (uint8_t*) malloc(q.len);
+	q.packet[0] = TYPE_DATA;
+	memcpy(q.packet + LORAL2_TDMA_HDR_LEN, packet, payload_len);
+	++count;
+	return true;
+}
+
+void LoRaL2Tdma::pop()
+{
+	free(queue[head].packet);
+	queue[head].packet = 0;
+	head = (head + 1) % LORAL2_TDMA_QUEUE;
+	--count;
+}
+
+size_t LoRaL2Tdma::poll()
+{
+	size_t frames = l2->poll();
+	uint32_t now = network_us();
+
+	if (coordinator) {
+		if ((int32_t) (now - next_beacon) >= 0) {
+			send_beacon(now);
+		}
+	} else if (is_synced && now - last_beacon > LORAL2_TDMA_SYNC_LOSS * superframe) {
+		is_synced = false;
+	}
+
+	if (is_synced && count && slot >= 0 && slot < slots) {
+		send_queued(now);
+	}
+	return frames;
+}
+
+void LoRaL2Tdma::send_beacon(uint32_t now)
+{
+	uint8_t beacon[LORAL2_TDMA_BEACON_LEN];
+	beacon[0] = TYPE_BEACON;
+	put32(beacon + 1, now);
+	beacon[5] = slots;
+	put32(beacon + 6, slot_len);
+	put32(beacon + 10, beacon_slot_len);
+	put32(beacon + 14, guard);
+	// if the radio is busy, retry on next poll; nodes follow the time
+	// in the beacon, not the nominal superframe start
+	if (l2->send(beacon, sizeof(beacon))) {
+		last_beacon = now;
+		next_beacon = now + superframe;
+		++n_beacons;
+	}
+}
+
+void LoRaL2Tdma::send_queued(uint32_t now)
+{
+	uint32_t pos = (now - last_beacon) % superframe;
+	uint32_t start = beacon_slot_len + slot * slot_len;
+	uint32_t slot_start = now - pos + start;
+	if (slot_used && slot_start == last_slot) {
+		return;
+	}
+
+	uint32_t air = l2->airtime_us(queue[head].len);
+	if (air + guard > slot_len) {
+		// can never fit
+		pop();
+		++n_dropped;
+		return;
+	}
+	// half the guard on each side, to absorb the sync error
+	if (pos < start + guard / 2 || pos + air > start + slot_len - guard / 2) {
+		return;
+	}
+	if (l2->send(queue[head].packet, queue[head].len)) {
+		pop();
+		++n_sent;
+		slot_used = true;
+		last_slot = slot_start;
+	}
+}
+
+void LoRaL2Tdma::recv(LoRaL2Packet *pkt)
+{
+	if (pkt->err) {
+		observer->recv(pkt);
+		return;
+	}
+	if (pkt->len < LORAL2_TDMA_HDR_LEN) {
+		pkt->err = TDMA_ERR_SHORT;
+		observer->recv(pkt);
+		return;
+	}
+	if (pkt->packet[0] == TYPE_BEACON) {
+		if (pkt->len >= LORAL2_TDMA_BEACON_LEN && !coordinator) {
+			recv_beacon(pkt->packet, pkt->time_us);
+		}
+		delete pkt;
+		return;
+	}
+
+	pkt->len -= LORAL2_TDMA_HDR_LEN;
+	memmove(pkt->packet, pkt->packet + LORAL2_TDMA_HDR_LEN, pkt->len);
+	observer->recv(pkt);
+}
+
+// rx_time_us is the local time the beacon ended, as captured by the
+// radio interrupt; it left the coordinator one time-on-air earlier
+void LoRaL2Tdma::recv_beacon(const uint8_t *packet, uint32_t rx_time_us)
+{
+	uint32_t sent_at = get32(packet + 1);
+	offset = sent_at + l2->airtime_us(LORAL2_TDMA_BEACON_LEN) - rx_time_us;
+	last_beacon = sent_at;
+	slots = packet[5];
+	slot_len = get32(packet + 6);
+	beacon_slot_len = get32(packet + 10);
+	guard = get32(packet + 14);
+	superframe = beacon_slot_len + slots * slot_len;
+	is_synced = superframe > 0;
+	++n_beacons;
+}
@@ -0,0 +1,138 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Scheduled access (TDMA) on top of LoRaL2, for fixed fleets of nodes,
+// where pure ALOHA would collapse under load. A coordinator sends a
+// beacon at the start of every superframe, carrying its clock and the
+// schedule; the other nodes keep an offset to that clock, and send only
+// within their assigned data slot, one frame per superframe.
+//
+// Superframe: beacon slot, then data slots 0..slots-1. Slots are sized
+// by the coordinator from the time-on-air of the largest frame, plus a
+// guard of a few symbols and the clock drift over a superframe, plus a
+// window for poll() to notice the slot.
+//
+// Each payload carries a 1-octet type header.
+
+#ifndef __TDMA_H
+#define __TDMA_H
+
+#include <cstddef>
+#include <cinttypes>
+#include "LoRaL2.h"
+
+// Frames waiting for our slot
+#ifndef LORAL2_TDMA_QUEUE
+#define LORAL2_TDMA_QUEUE 4
+#endif
+
+// Guard, in LoRa symbols: RX timestamp and processing jitter
+#ifndef LORAL2_TDMA_GUARD_SYMBOLS
+#define LORAL2_TDMA_GUARD_SYMBOLS 8
+#endif
+
+// Clock tolerance of each end
+#ifndef LORAL2_TDMA_DRIFT_PPM
+#define LORAL2_TDMA_DRIFT_PPM 100
+#endif
+
+// Latest start of a transmission after the slot guard, i.e. how often
+// poll() must be called
+#ifndef LORAL2_TDMA_TX_WINDOW_US
+#define LORAL2_TDMA_TX_WINDOW_US 2000
+#endif
+
+// Superframes without a beacon before a node stops sending
+#ifndef LORAL2_TDMA_SYNC_LOSS
+#define LORAL2_TDMA_SYNC_LOSS 3
+#endif
+
+#define LORAL2_TDMA_HDR_LEN 1
+// the beacon carries the slot count in one octet
+#define LORAL2_TDMA_MAX_SLOTS 255
+// type, time, slots, slot length, beacon slot length, guard
+#define LORAL2_TDMA_BEACON_LEN 18
+
+#define LORAL2_TDMA_NO_SLOT -1
+
+// Frame too short for the TDMA header
+#define TDMA_ERR_SHORT 1401
+
+class LoRaL2Tdma: public LoRaL2Observer {
+public:
+	LoRaL2Tdma(const LoRaL2Tdma&) = delete;
+	void operator=(const LoRaL2Tdma&) = delete;
+
+	// Same parameters as LoRaL2, plus the data slot of this node
+	// (or LORAL2_TDMA_NO_SLOT to only listen); observer receives
+	// packets without the TDMA header. Radio must outlive it.
+	LoRaL2Tdma(RadioDriver *radio, long int band, int spread, int bandwidth,
+		const char *key, size_t key_len, int slot, LoRaL2Observer *observer);
+	virtual ~LoRaL2Tdma();
+
+	// Makes this node the coordinator, with a schedule of 'slots' data
+	// slots (1..LORAL2_TDMA_MAX_SLOTS), each fitting a payload of
+	// payload_len octets. Returns false if slots is out of range.
+	bool set_coordinator(int slots, size_t payload_len);
+
+	// Queues packet for the next slot of this node
+	bool send(const uint8_t *packet, size_t payload_len);
+	size_t max_payload() const;
+	// Must be called often (e.g. from loop(), at least every
+	// LORAL2_TDMA_TX_WINDOW_US): receives, sends beacons and
+	// queued frames. Returns frames processed.
+	size_t poll();
+	LoRaL2 *link();
+
+	// Received a beacon recently (always true for the coordinator)
+	bool synced() const;
+	// arduino_micros() of the coordinator
+	uint32_t network_us() const;
+	uint32_t superframe_us() const;
+	uint32_t guard_us() const;
+
+	uint32_t beacons() const;	// sent or heard
+	uint32_t sent() const;
+	uint32_t dropped() const;	// queue full, or frame longer than a slot
+
+	virtual void recv(LoRaL2Packet *pkt);
+
+	/* private */
+	struct Queued {
+		uint8_t *packet;
+		size_t len;
+	};
+
+	void recv_beacon(const uint8_t *packet, uint32_t rx_time_us);
+	void send_beacon(uint32_t now);
+	void send_queued(uint32_t now);
+	void pop();
+
+	LoRaL2 *l2;
+	LoRaL2Observer *observer;
+	int spread;
+	int bandwidth;
+	int slot;
+	bool coordinator;
+	bool is_synced;
+	int32_t offset;		// network time minus local time
+	uint32_t last_beacon;	// network time
+	uint32_t next_beacon;
+	int slots;
+	uint32_t slot_len;
+	uint32_t beacon_slot_len;
+	uint32_t guard;
+	uint32_t superframe;
+	bool slot_used;
+	uint32_t last_slot;	// network time of the last slot used
+	Queued queue[LORAL2_TDMA_QUEUE];
+	size_t head;
+	size_t count;
+	uint32_t n_beacons;
+	uint32_t n_sent;
+	uint32_t n_dropped;
+};
+
+#endif
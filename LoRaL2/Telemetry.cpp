@@ -0,0 +1,270 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <string.h>
+#include <math.h>
+#include "Telemetry.h"
+
+static_assert(LORAL2_TELEMETRY_STREAMS <= 16, "stream id has 4 bits");
+static_assert((LORAL2_TELEMETRY_HISTORY & (LORAL2_TELEMETRY_HISTORY - 1)) == 0 &&
+		LORAL2_TELEMETRY_HISTORY >= 2 && LORAL2_TELEMETRY_HISTORY <= 256,
+		"LORAL2_TELEMETRY_HISTORY must be a power of 2, from 2 to 256");
+
+// stream, delta flag, sequence number, reference (delta only)
+#define HDR_BITS (4 + 1 + 8)
+#define REF_BITS 8
+#define VARINT_MAX_BITS 40
+
+// MSB first
+struct BitWriter {
+	BitWriter(uint8_t *out, size_t len): out(out), max(len * 8), pos(0), full(false) {}
+
+	void put(uint32_t v, int n) {
+		for (int i = n - 1; i >= 0; --i) {
+			if (pos >= max) {
+				full = true;
+				return;
+			}
+			uint8_t mask = 0x80 >> (pos & 7);
+			if ((v >> i) & 1) {
+				out[pos >> 3] |= mask;
+			} else {
+				out[pos >> 3] &= ~mask;
+			}
+			++pos;
+		}
+	}
+
+	// zig-zag, then 7 bits per group, continuation bit first
+	void put_varint(int32_t v) {
+		uint32_t z = ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+		while (z >= 0x80) {
+			put(0x80 | (z & 0x7f), 8);
+			z >>= 7;
+		}
+		put(z, 8);
+	}
+
+	// Pads to the octet boundary with zeros, returns length
+	size_t finish() {
+		if (pos & 7) {
+			out[pos >> 3] &= ~(0xff >> (pos & 7));
+		}
+		return (pos + 7) / 8;
+	}
+
+	uint8_t *out;
+	size_t max;
+	size_t pos;
+	bool full;
+};
+
+struct BitReader {
+	BitReader(const uint8_t *in, size_t len): in(in), max(len * 8), pos(0), past_end(false) {}
+
+	uint32_t get(int n) {
+		uint32_t v = 0;
+		for (int i = 0; i < n; ++i) {
+			if (pos >= max) {
+				past_end = true;
+				return 0;
+			}
+			v = (v << 1) | ((in[pos >> 3] >> (7 - (pos & 7))) & 1);
+			++pos;
+		}
+		return v;
+	}
+
+	int32_t get_varint() {
+		uint32_t z = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			uint32_t group = get(8);
+			z |= (group & 0x7f) << shift;
+			if (!(group & 0x80)) {
+				return (int32_t) ((z >> 1) ^ -(z & 1));
+			}
+		}
+		past_end = true;	// too long, not a varint
+		return 0;
+	}
+
+	const uint8_t *in;
+	size_t max;
+	size_t pos;
+	bool past_end;
+};
+
+static uint32_t mask(int bits)
+{
+	return bits >= 32 ? 0xffffffff : (1UL << bits) - 1;
+}
+
+static float scale_of(const LoRaL2Field &f)
+{
+	return f.scale ? f.scale : 1;
+}
+
+void LoRaL2Reading::set(const LoRaL2Field *schema, size_t i, float quantity)
+{
+	values[i] = lroundf(quantity * scale_of(schema[i]));
+}
+
+float LoRaL2Reading::get(const LoRaL2Field *schema, size_t i) const
+{
+	return values[i] / scale_of(schema[i]);
+}
+
+LoRaL2TelemetryEncoder::LoRaL2TelemetryEncoder(const LoRaL2Field *schema, size_t count)
+{
+	this->schema = schema;
+	this->count = count < LORAL2_TELEMETRY_FIELDS ? count : LORAL2_TELEMETRY_FIELDS;
+	memset(streams, 0, sizeof(streams));
+}
+
+size_t LoRaL2TelemetryEncoder::max_len() const
+{
+	size_t bits = HDR_BITS + REF_BITS;
+	for (size_t i = 0; i < count; ++i) {
+		bits += schema[i].type == LORAL2_FIELD_BITS ? schema[i].bits : VARINT_MAX_BITS;
+	}
+	return (bits + 7) / 8;
+}
+
+size_t LoRaL2TelemetryEncoder::encode(LoRaL2Reading &reading, uint8_t *out, size_t out_len)
+{
+	if (reading.stream >= LORAL2_TELEMETRY_STREAMS) {
+		return 0;
+	}
+	Stream &s = streams[reading.stream];
+
+	BitWriter w(out, out_len);
+	w.put(reading.stream, 4);
+	w.put(s.has_ref, 1);
+	w.put(s.next_seq, 8);
+	if (s.has_ref) {
+		w.put(s.ref_seq, REF_BITS);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const LoRaL2Field &f = schema[i];
+		int32_t v = reading.values[i];
+		if (f.type == LORAL2_FIELD_BITS) {
+			w.put(v & mask(f.bits), f.bits);
+		} else if (f.delta && s.has_ref) {
+			w.put_varint((uint32_t) v - (uint32_t) s.ref[i]);
+		} else {
+			w.put_varint(v);
+		}
+	}
+	if (w.full) {
+		return 0;
+	}
+
+	reading.seq = s.next_seq++;
+	size_t slot = reading.seq & (LORAL2_TELEMETRY_HISTORY - 1);
+	s.sent_seq[slot] = reading.seq;
+	memcpy(s.sent[slot], reading.values, count * sizeof(int32_t));
+	if (s.sent_count < LORAL2_TELEMETRY_HISTORY) {
+		++s.sent_count;
+	}
+	return w.finish();
+}
+
+bool LoRaL2TelemetryEncoder::ack(uint8_t stream, uint8_t seq)
+{
+	if (stream >= LORAL2_TELEMETRY_STREAMS) {
+		return false;
+	}
+	Stream &s = streams[stream];
+	// readings sent, newest first: next_seq - 1, next_seq - 2...
+	uint8_t age = s.next_seq - 1 - seq;
+	if (age >= s.sent_count) {
+		return false;
+	}
+	size_t slot = seq & (LORAL2_TELEMETRY_HISTORY - 1);
+	memcpy(s.ref, s.sent[slot], count * sizeof(int32_t));
+	s.ref_seq = seq;
+	s.has_ref = true;
+	return true;
+}
+
+void LoRaL2TelemetryEncoder::reset(uint8_t stream)
+{
+	if (stream < LORAL2_TELEMETRY_STREAMS) {
+		streams[stream].has_ref = false;
+	}
+}
+
+LoRaL2TelemetryDecoder::LoRaL2TelemetryDecoder(const LoRaL2Field *schema, size_t count)
+{
+	this->schema = schema;
+	this->count = count < LORAL2_TELEMETRY_FIELDS ? count : LORAL2_TELEMETRY_FIELDS;
+	memset(streams, 0, sizeof(streams));
+	for (size_t i = 0; i < LORAL2_TELEMETRY_STREAMS; ++i) {
+		streams[i].pinned = LORAL2_TELEMETRY_HISTORY;	// none
+	}
+}
+
+int LoRaL2TelemetryDecoder::decode(const uint8_t *in, size_t len, LoRaL2Reading &reading,
+		size_t &used)
+{
+	used = 0;
+	BitReader r(in, len);
+	uint32_t stream = r.get(4);
+	bool delta = r.get(1);
+	uint8_t seq = r.get(8);
+	uint8_t ref_seq = delta ? r.get(REF_BITS) : 0;
+	if (r.past_end || stream >= LORAL2_TELEMETRY_STREAMS) {
+		return TELEMETRY_ERR_DATA;
+	}
+
+	int32_t values[LORAL2_TELEMETRY_FIELDS];
+	for (size_t i = 0; i < count; ++i) {
+		const LoRaL2Field &f = schema[i];
+		values[i] = f.type == LORAL2_FIELD_BITS ? r.get(f.bits) : r.get_varint();
+	}
+	if (r.past_end) {
+		return TELEMETRY_ERR_DATA;
+	}
+	// even if the reference is missing, the next reading can be decoded
+	used = (r.pos + 7) / 8;
+
+	Stream &s = streams[stream];
+	if (delta) {
+		const int32_t *ref = 0;
+		for (size_t i = 0; i < s.count; ++i) {
+			if (s.seq[i] == ref_seq) {
+				ref = s.values[i];
+				s.pinned = i;
+				break;
+			}
+		}
+		if (!ref) {
+			// tells the caller which stream to reset
+			reading.stream = stream;
+			reading.seq = seq;
+			return TELEMETRY_ERR_REF;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			if (schema[i].type == LORAL2_FIELD_VARINT && schema[i].delta) {
+				values[i] = (uint32_t) values[i] + (uint32_t) ref[i];
+			}
+		}
+	}
+
+	if (s.next == s.pinned) {
+		s.next = (s.next + 1) % LORAL2_TELEMETRY_HISTORY;
+	}
+	s.seq[s.next] = seq;
+	memcpy(s.values[s.next], values, count * sizeof(int32_t));
+	s.next = (s.next + 1) % LORAL2_TELEMETRY_HISTORY;
+	if (s.count < LORAL2_TELEMETRY_HISTORY) {
+		++s.count;
+	}
+
+	reading.stream = stream;
+	reading.seq = seq;
+	memcpy(reading.values, values, count * sizeof(int32_t));
+	return 0;
+}
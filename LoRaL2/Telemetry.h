@@ -0,0 +1,138 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Compact serialization of sensor readings, as an alternative to text.
+// A reading is a set of integer values described by a schema, a static
+// array of LoRaL2Field shared by sender and receiver. Fields are either
+// zig-zag varints (small magnitudes take few bits, sign is free) or
+// fixed-width unsigned bit fields; fractional quantities are fixed point,
+// scaled by the field's scale. Everything is bit-packed.
+//
+// Varint fields may be delta-encoded against the last reading of the
+// same stream that the receiver acknowledged (see ack()): a delta frame
+// names the sequence number of its reference, and the receiver keeps its
+// last readings, and the last reference used, to resolve it. Until an
+// ack arrives, or after reset(), full readings are sent.
+//
+// Encoding writes straight into the caller's buffer (e.g. the one passed
+// to LoRaL2::send()), with no allocation; several readings may be packed
+// back to back in a frame. Fixed memory: see the LORAL2_TELEMETRY_*
+// limits below.
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <cstddef>
+#include <cinttypes>
+
+#ifndef LORAL2_TELEMETRY_FIELDS
+#define LORAL2_TELEMETRY_FIELDS 16
+#endif
+
+// at most 16, the stream id has 4 bits
+#ifndef LORAL2_TELEMETRY_STREAMS
+#define LORAL2_TELEMETRY_STREAMS 2
+#endif
+
+// Readings remembered per stream: sent ones waiting for an ack, and
+// received ones that deltas may refer to (at least 2)
+#ifndef LORAL2_TELEMETRY_HISTORY
+#define LORAL2_TELEMETRY_HISTORY 4
+#endif
+
+// Field types
+#define LORAL2_FIELD_VARINT 0	// signed, zig-zag varint
+#define LORAL2_FIELD_BITS 1	// unsigned, 'bits' wide
+
+// Malformed or truncated reading
+#define TELEMETRY_ERR_DATA 1301
+// Delta against a reading the receiver does not have (e.g. it
+// restarted); the sender must reset() the stream
+#define TELEMETRY_ERR_REF 1302
+
+struct LoRaL2Field {
+	uint8_t type;
+	uint8_t bits;		// width of LORAL2_FIELD_BITS, 1..32
+	bool delta;		// LORAL2_FIELD_VARINT only
+	float scale;		// fixed point: value = quantity * scale
+};
+
+struct LoRaL2Reading {
+	uint8_t stream;
+	uint8_t seq;		// set by encode() and decode()
+	int32_t values[LORAL2_TELEMETRY_FIELDS];
+
+	// Fixed-point conversion of a field
+	void set(const LoRaL2Field *schema, size_t i, float quantity);
+	float get(const LoRaL2Field *schema, size_t i) const;
+};
+
+class LoRaL2TelemetryEncoder {
+public:
+	LoRaL2TelemetryEncoder(const LoRaL2TelemetryEncoder&) = delete;
+	void operator=(const LoRaL2TelemetryEncoder&) = delete;
+
+	// schema must outlive the encoder
+	LoRaL2TelemetryEncoder(const LoRaL2Field *schema, size_t count);
+
+	// Encodes reading into out, and sets its sequence number. Returns
+	// the length, or 0 if it does not fit in out_len octets.
+	size_t encode(LoRaL2Reading &reading, uint8_t *out, size_t out_len);
+	// Receiver got reading seq of stream; following readings are
+	// deltas against it. Returns false if seq is too old.
+	bool ack(uint8_t stream, uint8_t seq);
+	// Back to full readings, e.g. receiver restarted
+	void reset(uint8_t stream);
+	// Worst-case encoded length of a reading
+	size_t max_len() const;
+
+	/* private */
+	struct Stream {
+		uint8_t next_seq;
+		bool has_ref;
+		uint8_t ref_seq;
+		int32_t ref[LORAL2_TELEMETRY_FIELDS];
+		// readings sent, for ack()
+		uint8_t sent_seq[LORAL2_TELEMETRY_HISTORY];
+		int32_t sent[LORAL2_TELEMETRY_HISTORY][LORAL2_TELEMETRY_FIELDS];
+		size_t sent_count;
+	};
+
+	const LoRaL2Field *schema;
+	size_t count;
+	Stream streams[LORAL2_TELEMETRY_STREAMS];
+};
+
+class LoRaL2TelemetryDecoder {
+public:
+	LoRaL2TelemetryDecoder(const LoRaL2TelemetryDecoder&) = delete;
+	void operator=(const LoRaL2TelemetryDecoder&) = delete;
+
+	LoRaL2TelemetryDecoder(const LoRaL2Field *schema, size_t count);
+
+	// Decodes one reading from in; used gets the octets consumed, so
+	// the next reading of the frame starts at in + used. Returns 0 or
+	// TELEMETRY_ERR_*. Ack the reading's stream and seq to the sender.
+	// On TELEMETRY_ERR_REF, reading has only stream and seq set: nack
+	// the stream, and the sender must reset() it.
+	int decode(const uint8_t *in, size_t len, LoRaL2Reading &reading, size_t &used);
+
+	/* private */
+	struct Stream {
+		uint8_t seq[LORAL2_TELEMETRY_HISTORY];
+		int32_t values[LORAL2_TELEMETRY_HISTORY][LORAL2_TELEMETRY_FIELDS];
+		size_t count;
+		size_t next;
+		// last reading used as reference, which is kept: the
+		// sender goes on using it until it gets a newer ack
+		size_t pinned;
+	};
+
+	const LoRaL2Field *schema;
+	size_t count;
+	Stream streams[LORAL2_TELEMETRY_STREAMS];
+};
+
+#endif
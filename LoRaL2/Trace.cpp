@@ -0,0 +1,144 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <string.h>
+#include "Trace.h"
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+#ifdef LORAL2_TRACE
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+
+static_assert((LORAL2_TRACE_SLOTS & (LORAL2_TRACE_SLOTS - 1)) == 0,
+		"LORAL2_TRACE_SLOTS must be a power of 2");
+
+static LoRaL2TraceRecord ring[LORAL2_TRACE_SLOTS];
+// events logged; next slot is head % LORAL2_TRACE_SLOTS
+static uint32_t head = 0;
+static uint8_t units = 0;
+
+void loral2_trace(uint8_t unit, uint8_t event, uint16_t a, int32_t b, uint32_t time_us)
+{
+	uint32_t i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+	LoRaL2TraceRecord &r = ring[i & (LORAL2_TRACE_SLOTS - 1)];
+	r.time_us = time_us;
+	r.unit = unit;
+	r.a = a;
+	r.b = b;
+	__atomic_store_n(&r.event, event, __ATOMIC_RELEASE);
+}
+
+uint8_t loral2_trace_unit()
+{
+	return __atomic_fetch_add(&units, 1, __ATOMIC_RELAXED);
+}
+
+void loral2_trace_clear()
+{
+	for (size_t i = 0; i < LORAL2_TRACE_SLOTS; ++i) {
+		__atomic_store_n(&ring[i].event, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&head, 0, __ATOMIC_RELEASE);
+}
+
+size_t loral2_trace_dump(uint8_t *out, size_t out_len)
+{
+	uint32_t total = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	uint32_t count = total < LORAL2_TRACE_SLOTS ? total : LORAL2_TRACE_SLOTS;
+	if (out_len < LORAL2_TRACE_HDR_LEN + count * LORAL2_TRACE_REC_LEN) {
+		return 0;
+	}
+
+	uint8_t *p = out + LORAL2_TRACE_HDR_LEN;
+	uint32_t written = 0;
+	for (uint32_t i = total - count; i != total; ++i) {
+		const LoRaL2TraceRecord &r = ring[i & (LORAL2_TRACE_SLOTS - 1)];
+		uint8_t event = __atomic_load_n(&r.event, __ATOMIC_ACQUIRE);
+		if (!event) {
+			// reserved but not written yet
+			continue;
+		}
+		put32(p, r.time_us);
+		p[4] = r.unit;
+		p[5] = event;
+		put16(p + 6, r.a);
+		put32(p + 8, r.b);
+		p += LORAL2_TRACE_REC_LEN;
+		++written;
+	}
+
+	memcpy(out, "L2TR", 4);
+	put16(out + 4, LORAL2_TRACE_VERSION);
+	put16(out + 6, written);
+	put32(out + 8, total);
+	return p - out;
+}
+
+#endif
+
+int loral2_trace_parse(const uint8_t *dump, size_t len,
+		LoRaL2TraceRecord *out, size_t max, uint32_t &total)
+{
+	if (len < LORAL2_TRACE_HDR_LEN || memcmp(dump, "L2TR", 4) ||
+			get16(dump + 4) != LORAL2_TRACE_VERSION) {
+		return -1;
+	}
+	size_t count = get16(dump + 6);
+	total = get32(dump + 8);
+	if (len < LORAL2_TRACE_HDR_LEN + count * LORAL2_TRACE_REC_LEN) {
+		return -1;
+	}
+
+	const uint8_t *p = dump + LORAL2_TRACE_HDR_LEN;
+	size_t n = 0;
+	for (; n < count && n < max; ++n, p += LORAL2_TRACE_REC_LEN) {
+		out[n].time_us = get32(p);
+		out[n].unit = p[4];
+		out[n].event = p[5];
+		out[n].a = get16(p + 6);
+		out[n].b = (int32_t) get32(p + 8);
+	}
+	return n;
+}
+
+const char *loral2_trace_event_name(int event)
+{
+	static const char *names[LORAL2_EV_COUNT] = {
+		"?",
+		"tx_enqueue",
+		"tx_start",
+		"tx_done",
+		"rx_isr",
+		"rx_drop",
+		"fec",
+		"addr_discard",
+		"duplicate",
+		"decrypt",
+		"dispatch",
+	};
+	if (event <= 0 || event >= LORAL2_EV_COUNT) {
+		return names[0];
+	}
+	return names[event];
+}
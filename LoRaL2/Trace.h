@@ -0,0 +1,85 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Binary event trace of the TX and RX pipeline, for post-mortem analysis
+// of nodes in the field. Compiled in only if LORAL2_TRACE is defined;
+// otherwise LORAL2_TRACE_EVENT() expands to nothing.
+//
+// Events go to a fixed ring of LORAL2_TRACE_SLOTS records, the oldest
+// being overwritten. Any context (interrupt, worker, loop) may log: a
+// slot is reserved by a single atomic increment, no locks. A record
+// being overwritten while the ring is dumped may come out torn.
+//
+// loral2_trace_dump() serializes the ring, to be sent over serial or
+// saved; test/tracedump turns a dump into a timeline.
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <cstddef>
+#include <cinttypes>
+
+#ifndef LORAL2_TRACE_SLOTS
+#define LORAL2_TRACE_SLOTS 128
+#endif
+
+// Events and their arguments
+enum {
+	LORAL2_EV_TX_ENQUEUE = 1,	// a: payload length
+	LORAL2_EV_TX_START,		// a: frame length, b: TX id
+	LORAL2_EV_TX_DONE,		// a: status, b: TX id
+	LORAL2_EV_RX_ISR,		// a: frame length, b: RSSI
+	LORAL2_EV_RX_DROP,		// RX ring full
+	LORAL2_EV_FEC,			// a: error, b: corrected octets
+	LORAL2_EV_ADDR_DISCARD,		// a: destination
+	LORAL2_EV_DUPLICATE,
+	LORAL2_EV_DECRYPT,		// a: error, b: payload length
+	LORAL2_EV_DISPATCH,		// a: payload length, b: error
+	LORAL2_EV_COUNT
+};
+
+struct LoRaL2TraceRecord {
+	uint32_t time_us;
+	uint8_t unit;		// LoRaL2 instance, in order of creation
+	uint8_t event;		// 0 if never written
+	uint16_t a;
+	int32_t b;
+};
+
+// Dump: "L2TR", version, record count, events logged since clear
+// (more than the count if some were overwritten), then the records,
+// oldest first. All little-endian.
+#define LORAL2_TRACE_HDR_LEN 12
+#define LORAL2_TRACE_REC_LEN 12
+#define LORAL2_TRACE_VERSION 1
+
+#ifdef LORAL2_TRACE
+
+#define LORAL2_TRACE_EVENT(unit, event, a, b) \
+	loral2_trace((unit), (event), (a), (b), arduino_micros())
+#define LORAL2_TRACE_EVENT_AT(time_us, unit, event, a, b) \
+	loral2_trace((unit), (event), (a), (b), (time_us))
+
+void loral2_trace(uint8_t unit, uint8_t event, uint16_t a, int32_t b, uint32_t time_us);
+uint8_t loral2_trace_unit();
+void loral2_trace_clear();
+// Returns octets written, or 0 if out is too small;
+// LORAL2_TRACE_HDR_LEN + LORAL2_TRACE_SLOTS * LORAL2_TRACE_REC_LEN always fits
+size_t loral2_trace_dump(uint8_t *out, size_t out_len);
+
+#else
+
+#define LORAL2_TRACE_EVENT(unit, event, a, b) do {} while (0)
+#define LORAL2_TRACE_EVENT_AT(time_us, unit, event, a, b) do {} while (0)
+
+#endif
+
+// Decoding side, available in any build. Returns records parsed into
+// out, or -1 if the dump is malformed; total gets events logged.
+int loral2_trace_parse(const uint8_t *dump, size_t len,
+		LoRaL2TraceRecord *out, size_t max, uint32_t &total);
+const char *loral2_trace_event_name(int event);
+
+#endif
@@ -215,6 +215,9 @@ public:
     void encryptBlock(uint8_t *output, const uint8_t *input);
     void decryptBlock(uint8_t *output, const uint8_t *input);
 
+    void decryptBlocksCBC(uint8_t *output, const uint8_t *input, size_t count,
+                          const uint8_t *iv);
+
     void clear();
 
 protected:
@@ -68,6 +68,16 @@ void AESCommon::decryptBlock(uint8_t *output, const uint8_t *input)
     esp_aes_decrypt(&ctx, input, output);
 }
 
+void AESCommon::decryptBlocksCBC(uint8_t *output, const uint8_t *input, size_t count,
+                                 const uint8_t *iv)
+{
+    // One call holds the hardware and loads the key once for the whole
+    // run. esp_aes_crypt_cbc() updates the IV, so pass a copy.
+    uint8_t chain[16];
+    memcpy(chain, iv, sizeof(chain));
+    esp_aes_crypt_cbc(&ctx, ESP_AES_DECRYPT, count * 16, chain, input, output);
+}
+
 void AESCommon::clear()
 {
     clean(ctx.key, sizeof(ctx.key));
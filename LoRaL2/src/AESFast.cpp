@@ -0,0 +1,440 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include "AESFast.h"
+#include "Crypto.h"
+#include <string.h>
+
+#if defined(CRYPTO_AES_FAST)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AESFAST_HAVE_NI 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+/**
+ * \class AESFast256 AESFast.h <AESFast.h>
+ * \brief AES block cipher with 256-bit keys, tuned for host CPUs.
+ *
+ * Bit-compatible with AES256, but much faster on PCs and gateways.
+ * The AES-NI instructions are used if the CPU supports them (checked at
+ * runtime, no special compiler flags needed). Otherwise, encryption and
+ * decryption fall back to the classic 32-bit T-table implementation.
+ *
+ * \note The T-table fallback does not have constant cache behaviour,
+ * same as AESCommon.
+ */
+
+/** @cond aesfast_tables */
+
+// T-tables, generated once from the S-box, on first use
+struct AESFastTables {
+    uint8_t sbox[256];
+    uint8_t sbox_inverse[256];
+    uint32_t te[4][256];
+    uint32_t td[4][256];
+
+    AESFastTables();
+};
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+    while (b) {
+        if (b & 1)
+            p ^= a;
+        a = (a << 1) ^ ((a & 0x80) ? 0x1B : 0x00);
+        b >>= 1;
+    }
+    return p;
+}
+
+static inline uint32_t ror8(uint32_t x)
+{
+    return (x >> 8) | (x << 24);
+}
+
+AESFastTables::AESFastTables()
+{
+    for (int x = 0; x < 256; ++x) {
+        // multiplicative inverse is x^254
+        uint8_t inv = 1;
+        for (int i = 0; i < 254; ++i)
+            inv = gf_mul(inv, x);
+        uint8_t s = inv;
+        for (int i = 1; i <= 4; ++i)
+            s ^= (uint8_t) ((inv << i) | (inv >> (8 - i)));
+        s ^= 0x63;
+        sbox[x] = s;
+        sbox_inverse[s] = x;
+    }
+
+    for (int x = 0; x < 256; ++x) {
+        uint8_t s = sbox[x];
+        te[0][x] = ((uint32_t) gf_mul(s, 2) << 24) | ((uint32_t) s << 16) |
+                   ((uint32_t) s << 8) | gf_mul(s, 3);
+        uint8_t si = sbox_inverse[x];
+        td[0][x] = ((uint32_t) gf_mul(si, 14) << 24) | ((uint32_t) gf_mul(si, 9) << 16) |
+                   ((uint32_t) gf_mul(si, 13) << 8) | gf_mul(si, 11);
+        for (int t = 1; t < 4; ++t) {
+            te[t][x] = ror8(te[t - 1][x]);
+            td[t][x] = ror8(td[t - 1][x]);
+        }
+    }
+}
+
+static const AESFastTables& tables()
+{
+    static const AESFastTables t;
+    return t;
+}
+
+#define GETU32(p)   (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                     ((uint32_t)(p)[2] << 8) | ((uint32_t)(p)[3]))
+#define PUTU32(p, v) do { (p)[0] = (uint8_t)((v) >> 24); (p)[1] = (uint8_t)((v) >> 16); \
+                          (p)[2] = (uint8_t)((v) >> 8); (p)[3] = (uint8_t)(v); } while (0)
+#define B0(x)   ((x) >> 24)
+#define B1(x)   (((x) >> 16) & 0xFF)
+#define B2(x)   (((x) >> 8) & 0xFF)
+#define B3(x)   ((x) & 0xFF)
+
+#define ROUNDS 14
+
+/** @endcond */
+
+/**
+ * \brief Constructs an AES 256-bit block cipher with no initial key.
+ *
+ * AES-NI is enabled by default if the CPU supports it.
+ */
+AESFast256::AESFast256()
+    : useNI(cpuHasAESNI())
+{
+    // force generation of tables here, out of the encryption path
+    tables();
+}
+
+AESFast256::~AESFast256()
+{
+    clear();
+}
+
+/**
+ * \brief Size of an AES block in bytes.
+ * \return Always returns 16.
+ */
+size_t AESFast256::blockSize() const
+{
+    return 16;
+}
+
+/**
+ * \brief Size of a 256-bit AES key in bytes.
+ * \return Always returns 32.
+ */
+size_t AESFast256::keySize() const
+{
+    return 32;
+}
+
+/**
+ * \brief Returns true if the CPU supports the AES-NI instructions.
+ */
+bool AESFast256::cpuHasAESNI()
+{
+#if defined(AESFAST_HAVE_NI)
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    return (c & bit_AES) != 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * \brief Returns true if encryption and decryption use AES-NI.
+ */
+bool AESFast256::accelerated() const
+{
+    return useNI;
+}
+
+/**
+ * \brief Enables or disables AES-NI.
+ *
+ * \param enable Request AES-NI (true) or T-tables (false).
+ * \return Returns the new value of accelerated(), which may be false
+ * even if \a enable is true, when the CPU lacks AES-NI.
+ *
+ * Mostly useful to test both code paths on the same machine.
+ */
+bool AESFast256::setAccelerated(bool enable)
+{
+    useNI = enable && cpuHasAESNI();
+    return useNI;
+}
+
+bool AESFast256::setKey(const uint8_t *key, size_t len)
+{
+    static uint8_t const rcon[7] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40};
+    const AESFastTables& t = tables();
+
+    if (len != 32)
+        return false;
+
+    // Encryption schedule, 60 big-endian words
+    uint32_t *w = encWords;
+    for (int i = 0; i < 8; ++i)
+        w[i] = GETU32(key + i * 4);
+    for (int i = 8; i < 4 * (ROUNDS + 1); ++i) {
+        uint32_t temp = w[i - 1];
+        if ((i % 8) == 0) {
+            temp = ((uint32_t) t.sbox[B1(temp)] << 24) ^
+                   ((uint32_t) t.sbox[B2(temp)] << 16) ^
+                   ((uint32_t) t.sbox[B3(temp)] << 8) ^
+                   ((uint32_t) t.sbox[B0(temp)]) ^
+                   ((uint32_t) rcon[i / 8 - 1] << 24);
+        } else if ((i % 8) == 4) {
+            temp = ((uint32_t) t.sbox[B0(temp)] << 24) ^
+                   ((uint32_t) t.sbox[B1(temp)] << 16) ^
+                   ((uint32_t) t.sbox[B2(temp)] << 8) ^
+                   ((uint32_t) t.sbox[B3(temp)]);
+        }
+        w[i] = w[i - 8] ^ temp;
+    }
+
+    // Decryption schedule for the equivalent inverse cipher:
+    // round keys in reverse order, InvMixColumns applied to inner rounds
+    uint32_t *dw = decWords;
+    for (int r = 0; r <= ROUNDS; ++r) {
+        for (int j = 0; j < 4; ++j) {
+            uint32_t k = w[(ROUNDS - r) * 4 + j];
+            if (r > 0 && r < ROUNDS) {
+                k = t.td[0][t.sbox[B0(k)]] ^ t.td[1][t.sbox[B1(k)]] ^
+                    t.td[2][t.sbox[B2(k)]] ^ t.td[3][t.sbox[B3(k)]];
+            }
+            dw[r * 4 + j] = k;
+        }
+    }
+
+    // AES-NI wants the same schedules as byte sequences
+    for (int i = 0; i < 4 * (ROUNDS + 1); ++i) {
+        PUTU32(encBytes + i * 4, encWords[i]);
+        PUTU32(decBytes + i * 4, decWords[i]);
+    }
+
+    return true;
+}
+
+/** @cond aesfast_ni */
+
+#if defined(AESFAST_HAVE_NI)
+
+__attribute__((target("aes,sse2")))
+static void ni_encrypt(const uint8_t *sched, uint8_t *output, const uint8_t *input)
+{
+    const __m128i *rk = (const __m128i*) sched;
+    __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*) input), _mm_load_si128(rk));
+    for (int r = 1; r < ROUNDS; ++r)
+        s = _mm_aesenc_si128(s, _mm_load_si128(rk + r));
+    s = _mm_aesenclast_si128(s, _mm_load_si128(rk + ROUNDS));
+    _mm_storeu_si128((__m128i*) output, s);
+}
+
+__attribute__((target("aes,sse2")))
+static void ni_decrypt(const uint8_t *sched, uint8_t *output, const uint8_t *input)
+{
+    const __m128i *rk = (const __m128i*) sched;
+    __m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*) input), _mm_load_si128(rk));
+    for (int r = 1; r < ROUNDS; ++r)
+        s = _mm_aesdec_si128(s, _mm_load_si128(rk + r));
+    s = _mm_aesdeclast_si128(s, _mm_load_si128(rk + ROUNDS));
+    _mm_storeu_si128((__m128i*) output, s);
+}
+
+// Blocks are independent in ECB mode, so 4 of them are kept in flight
+// to hide the latency of the AES instructions.
+
+#define NI_LANES 4
+
+__attribute__((target("aes,sse2")))
+static void ni_encrypt_blocks(const uint8_t *sched, uint8_t *output, const uint8_t *input,
+                              size_t count)
+{
+    const __m128i *rk = (const __m128i*) sched;
+    const __m128i *in = (const __m128i*) input;
+    __m128i *out = (__m128i*) output;
+    __m128i s[NI_LANES];
+
+    for (; count >= NI_LANES; count -= NI_LANES, in += NI_LANES, out += NI_LANES) {
+        __m128i k = _mm_load_si128(rk);
+        for (int b = 0; b < NI_LANES; ++b)
+            s[b] = _mm_xor_si128(_mm_loadu_si128(in + b), k);
+        for (int r = 1; r < ROUNDS; ++r) {
+            k = _mm_load_si128(rk + r);
+            for (int b = 0; b < NI_LANES; ++b)
+                s[b] = _mm_aesenc_si128(s[b], k);
+        }
+        k = _mm_load_si128(rk + ROUNDS);
+        for (int b = 0; b < NI_LANES; ++b)
+            _mm_storeu_si128(out + b, _mm_aesenclast_si128(s[b], k));
+    }
+
+    for (; count > 0; --count, ++in, ++out)
+        ni_encrypt(sched, (uint8_t*) out, (const uint8_t*) in);
+}
+
+__attribute__((target("aes,sse2")))
+static void ni_decrypt_blocks(const uint8_t *sched, uint8_t *output, const uint8_t *input,
+                              size_t count)
+{
+    const __m128i *rk = (const __m128i*) sched;
+    const __m128i *in = (const __m128i*) input;
+    __m128i *out = (__m128i*) output;
+    __m128i s[NI_LANES];
+
+    for (; count >= NI_LANES; count -= NI_LANES, in += NI_LANES, out += NI_LANES) {
+        __m128i k = _mm_load_si128(rk);
+        for (int b = 0; b < NI_LANES; ++b)
+            s[b] = _mm_xor_si128(_mm_loadu_si128(in + b), k);
+        for (int r = 1; r < ROUNDS; ++r) {
+            k = _mm_load_si128(rk + r);
+            for (int b = 0; b < NI_LANES; ++b)
+                s[b] = _mm_aesdec_si128(s[b], k);
+        }
+        k = _mm_load_si128(rk + ROUNDS);
+        for (int b = 0; b < NI_LANES; ++b)
+            _mm_storeu_si128(out + b, _mm_aesdeclast_si128(s[b], k));
+    }
+
+    for (; count > 0; --count, ++in, ++out)
+        ni_decrypt(sched, (uint8_t*) out, (const uint8_t*) in);
+}
+
+#endif
+
+/** @endcond */
+
+void AESFast256::encryptBlock(uint8_t *output, const uint8_t *input)
+{
+#if defined(AESFAST_HAVE_NI)
+    if (useNI) {
+        ni_encrypt(encBytes, output, input);
+        return;
+    }
+#endif
+
+    const AESFastTables& t = tables();
+    const uint32_t *rk = encWords;
+    uint32_t s0 = GETU32(input)      ^ rk[0];
+    uint32_t s1 = GETU32(input + 4)  ^ rk[1];
+    uint32_t s2 = GETU32(input + 8)  ^ rk[2];
+    uint32_t s3 = GETU32(input + 12) ^ rk[3];
+    uint32_t t0, t1, t2, t3;
+
+    for (int r = 1; r < ROUNDS; ++r) {
+        rk += 4;
+        t0 = t.te[0][B0(s0)] ^ t.te[1][B1(s1)] ^ t.te[2][B2(s2)] ^ t.te[3][B3(s3)] ^ rk[0];
+        t1 = t.te[0][B0(s1)] ^ t.te[1][B1(s2)] ^ t.te[2][B2(s3)] ^ t.te[3][B3(s0)] ^ rk[1];
+        t2 = t.te[0][B0(s2)] ^ t.te[1][B1(s3)] ^ t.te[2][B2(s0)] ^ t.te[3][B3(s1)] ^ rk[2];
+        t3 = t.te[0][B0(s3)] ^ t.te[1][B1(s0)] ^ t.te[2][B2(s1)] ^ t.te[3][B3(s2)] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    // Final round, no MixColumns
+    rk += 4;
+    const uint8_t *S = t.sbox;
+#define FINAL_E(a, b, c, d, k) \
+    (((uint32_t) S[B0(a)] << 24) ^ ((uint32_t) S[B1(b)] << 16) ^ \
+     ((uint32_t) S[B2(c)] << 8) ^ ((uint32_t) S[B3(d)]) ^ (k))
+    t0 = FINAL_E(s0, s1, s2, s3, rk[0]);
+    t1 = FINAL_E(s1, s2, s3, s0, rk[1]);
+    t2 = FINAL_E(s2, s3, s0, s1, rk[2]);
+    t3 = FINAL_E(s3, s0, s1, s2, rk[3]);
+#undef FINAL_E
+    PUTU32(output,      t0);
+    PUTU32(output + 4,  t1);
+    PUTU32(output + 8,  t2);
+    PUTU32(output + 12, t3);
+}
+
+void AESFast256::decryptBlock(uint8_t *output, const uint8_t *input)
+{
+#if defined(AESFAST_HAVE_NI)
+    if (useNI) {
+        ni_decrypt(decBytes, output, input);
+        return;
+    }
+#endif
+
+    const AESFastTables& t = tables();
+    const uint32_t *rk = decWords;
+    uint32_t s0 = GETU32(input)      ^ rk[0];
+    uint32_t s1 = GETU32(input + 4)  ^ rk[1];
+    uint32_t s2 = GETU32(input + 8)  ^ rk[2];
+    uint32_t s3 = GETU32(input + 12) ^ rk[3];
+    uint32_t t0, t1, t2, t3;
+
+    for (int r = 1; r < ROUNDS; ++r) {
+        rk += 4;
+        t0 = t.td[0][B0(s0)] ^ t.td[1][B1(s3)] ^ t.td[2][B2(s2)] ^ t.td[3][B3(s1)] ^ rk[0];
+        t1 = t.td[0][B0(s1)] ^ t.td[1][B1(s0)] ^ t.td[2][B2(s3)] ^ t.td[3][B3(s2)] ^ rk[1];
+        t2 = t.td[0][B0(s2)] ^ t.td[1][B1(s1)] ^ t.td[2][B2(s0)] ^ t.td[3][B3(s3)] ^ rk[2];
+        t3 = t.td[0][B0(s3)] ^ t.td[1][B1(s2)] ^ t.td[2][B2(s1)] ^ t.td[3][B3(s0)] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    // Final round, no InvMixColumns
+    rk += 4;
+    const uint8_t *Si = t.sbox_inverse;
+#define FINAL_D(a, b, c, d, k) \
+    (((uint32_t) Si[B0(a)] << 24) ^ ((uint32_t) Si[B1(b)] << 16) ^ \
+     ((uint32_t) Si[B2(c)] << 8) ^ ((uint32_t) Si[B3(d)]) ^ (k))
+    t0 = FINAL_D(s0, s3, s2, s1, rk[0]);
+    t1 = FINAL_D(s1, s0, s3, s2, rk[1]);
+    t2 = FINAL_D(s2, s1, s0, s3, rk[2]);
+    t3 = FINAL_D(s3, s2, s1, s0, rk[3]);
+#undef FINAL_D
+    PUTU32(output,      t0);
+    PUTU32(output + 4,  t1);
+    PUTU32(output + 8,  t2);
+    PUTU32(output + 12, t3);
+}
+
+void AESFast256::encryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+#if defined(AESFAST_HAVE_NI)
+    if (useNI) {
+        ni_encrypt_blocks(encBytes, output, input, count);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i)
+        encryptBlock(output + i * 16, input + i * 16);
+}
+
+void AESFast256::decryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+#if defined(AESFAST_HAVE_NI)
+    if (useNI) {
+        ni_decrypt_blocks(decBytes, output, input, count);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i)
+        decryptBlock(output + i * 16, input + i * 16);
+}
+
+void AESFast256::clear()
+{
+    clean(encWords);
+    clean(decWords);
+    clean(encBytes);
+    clean(decBytes);
+}
+
+#endif // CRYPTO_AES_FAST
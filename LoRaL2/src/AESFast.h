@@ -0,0 +1,54 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Fast AES-256 for host (non-Arduino) builds, e.g. Linux gateways.
+// Uses AES-NI when the CPU has it, 32-bit T-tables otherwise.
+
+#ifndef CRYPTO_AESFAST_h
+#define CRYPTO_AESFAST_h
+
+#include "BlockCipher.h"
+
+#if !defined(ARDUINO) && !defined(ESP32) && !defined(__AVR__)
+#define CRYPTO_AES_FAST 1
+#endif
+
+#if defined(CRYPTO_AES_FAST)
+
+class AESFast256 : public BlockCipher
+{
+public:
+    AESFast256();
+    virtual ~AESFast256();
+
+    size_t blockSize() const;
+    size_t keySize() const;
+
+    bool setKey(const uint8_t *key, size_t len);
+
+    void encryptBlock(uint8_t *output, const uint8_t *input);
+    void decryptBlock(uint8_t *output, const uint8_t *input);
+
+    void encryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+    void decryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+
+    void clear();
+
+    bool accelerated() const;
+    bool setAccelerated(bool enable);
+
+    static bool cpuHasAESNI();
+
+private:
+    bool useNI;
+    uint32_t encWords[60];
+    uint32_t decWords[60];
+    alignas(16) uint8_t encBytes[240];
+    alignas(16) uint8_t decBytes[240];
+};
+
+#endif // CRYPTO_AES_FAST
+
+#endif
@@ -112,6 +112,99 @@ BlockCipher::~BlockCipher()
  * \sa encryptBlock(), blockSize()
  */
 
+/**
+ * \brief Encrypts several consecutive blocks using this cipher, in ECB mode.
+ *
+ * \param output The output buffer to put the ciphertext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the plaintext from which is
+ * allowed to be the same as \a output, but must not partially overlap it.
+ * \param count The number of blocks to encrypt.
+ *
+ * The default implementation calls encryptBlock() for each block.
+ * Subclasses may override it to process several blocks in parallel.
+ *
+ * \sa decryptBlocks(), encryptBlock()
+ */
+void BlockCipher::encryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    size_t bs = blockSize();
+    for (size_t i = 0; i < count; ++i)
+        encryptBlock(output + i * bs, input + i * bs);
+}
+
+/**
+ * \brief Decrypts several consecutive blocks using this cipher, in ECB mode.
+ *
+ * \param output The output buffer to put the plaintext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the ciphertext from which is
+ * allowed to be the same as \a output, but must not partially overlap it.
+ * \param count The number of blocks to decrypt.
+ *
+ * The default implementation calls decryptBlock() for each block.
+ * Subclasses may override it to process several blocks in parallel.
+ *
+ * \sa encryptBlocks(), decryptBlock()
+ */
+void BlockCipher::decryptBlocks(uint8_t *output, const uint8_t *input, size_t count)
+{
+    size_t bs = blockSize();
+    for (size_t i = 0; i < count; ++i)
+        decryptBlock(output + i * bs, input + i * bs);
+}
+
+/**
+ * \brief Decrypts several consecutive blocks using this cipher, in CBC mode.
+ *
+ * \param output The output buffer to put the plaintext into.
+ * Must be at least \a count * blockSize() bytes in length.
+ * \param input The input buffer to read the ciphertext from, which
+ * must not overlap \a output.
+ * \param count The number of blocks to decrypt.
+ * \param iv The initialization vector, i.e. the ciphertext block that
+ * precedes \a input; blockSize() bytes. It is not modified.
+ *
+ * The default implementation calls decryptBlocks(), then XORs each block
+ * with the preceding ciphertext block. Subclasses may override it when
+ * the hardware does CBC natively.
+ *
+ * \sa decryptBlocks()
+ */
+void BlockCipher::decryptBlocksCBC(uint8_t *output, const uint8_t *input, size_t count,
+                                   const uint8_t *iv)
+{
+    if (!count)
+        return;
+    size_t bs = blockSize();
+    decryptBlocks(output, input, count);
+    xorBytes(output, iv, bs);
+    xorBytes(output + bs, input, (count - 1) * bs);
+}
+
+// Word type that may alias the byte buffers
+typedef uint32_t __attribute__((__may_alias__)) XorWord;
+
+/**
+ * \brief XORs \a len bytes of \a src into \a dst, a word at a time
+ * when both are word-aligned.
+ */
+void BlockCipher::xorBytes(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    if ((((uintptr_t)dst | (uintptr_t)src) & (sizeof(XorWord) - 1)) == 0) {
+        XorWord *d = (XorWord *)dst;
+        const XorWord *s = (const XorWord *)src;
+        size_t words = len / sizeof(XorWord);
+        for (size_t i = 0; i < words; ++i)
+            d[i] ^= s[i];
+        dst += words * sizeof(XorWord);
+        src += words * sizeof(XorWord);
+        len -= words * sizeof(XorWord);
+    }
+    for (size_t i = 0; i < len; ++i)
+        dst[i] ^= src[i];
+}
+
 /**
  * \fn void BlockCipher::clear()
  * \brief Clears all security-sensitive state from this block cipher.
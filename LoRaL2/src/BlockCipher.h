@@ -40,7 +40,15 @@ public:
     virtual void encryptBlock(uint8_t *output, const uint8_t *input) = 0;
     virtual void decryptBlock(uint8_t *output, const uint8_t *input) = 0;
 
+    virtual void encryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+    virtual void decryptBlocks(uint8_t *output, const uint8_t *input, size_t count);
+    virtual void decryptBlocksCBC(uint8_t *output, const uint8_t *input, size_t count,
+                                  const uint8_t *iv);
+
     virtual void clear() = 0;
+
+protected:
+    static void xorBytes(uint8_t *dst, const uint8_t *src, size_t len);
 };
 
 #endif
@@ -0,0 +1 @@
+../LoRaL2/src/AESFast.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/src/AESFast.h
\ No newline at end of file
@@ -0,0 +1,380 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "ChannelSim.h"
+#include "LoRaL2.h"
+
+#define EV_TX_START 1
+#define EV_TX_END 2
+#define EV_CALL 3
+
+#define NOISE_FIGURE 6
+
+SimRadio::SimRadio(ChannelSim *sim, int id)
+{
+	this->sim = sim;
+	this->id = id;
+	this->observer = 0;
+	this->band = 0;
+	this->spread = 7;
+	this->bandwidth = 125000;
+	this->cr4slsh = 5;
+	this->transmitting = false;
+	this->fifo = 0;
+}
+
+bool SimRadio::start(long int band, int spread, int bandwidth, int power,
+		int paboost, int cr4slsh, LoRaL2 *pobserver)
+{
+	this->band = band;
+	this->spread = spread;
+	this->bandwidth = bandwidth;
+	this->cr4slsh = cr4slsh;
+	observer = pobserver;
+	return true;
+}
+
+void SimRadio::receive()
+{
+}
+
+bool SimRadio::begin_packet()
+{
+	return !transmitting;
+}
+
+void SimRadio::read(uint8_t* buffer, size_t len)
+{
+	memcpy(buffer, fifo, len);
+	fifo += len;
+}
+
+void SimRadio::finish_packet_sg(const RadioFrag* frags, size_t count)
+{
+	uint64_t tx = sim->next_tx++;
+	SimTx &t = sim->txs[tx];
+	t.node = id;
+	for (size_t i = 0; i < count; ++i) {
+		t.frame.insert(t.frame.end(), frags[i].data, frags[i].data + frags[i].len);
+	}
+	transmitting = true;
+	// as a separate event, so a frame sent from within a callback
+	// does not disturb the event being processed
+	sim->push(sim->now, EV_TX_START, tx, 0);
+}
+
+ChannelSim::ChannelSim(uint32_t seed)
+{
+	tx_frames = rx_frames = rx_corrupted = 0;
+	collisions = captures = half_duplex = undetected = 0;
+	now = 0;
+	seq = 0;
+	next_tx = 0;
+	model = SIM_ERR_AWGN;
+	p_good_bad = 0.001;
+	p_bad_good = 0.1;
+	bad_ber = 0.05;
+	capture_db = 6.0;
+
+	// xoshiro128** seeded through splitmix32
+	for (int i = 0; i < 4; ++i) {
+		uint32_t z = (seed += 0x9e3779b9);
+		z = (z ^ (z >> 16)) * 0x85ebca6b;
+		z = (z ^ (z >> 13)) * 0xc2b2ae35;
+		rng_state[i] = z ^ (z >> 16);
+	}
+}
+
+ChannelSim::~ChannelSim()
+{
+	for (size_t i = 0; i < radios.size(); ++i) {
+		delete radios[i];
+	}
+}
+
+int ChannelSim::add_node()
+{
+	int id = radios.size();
+	radios.push_back(new SimRadio(this, id));
+	links.push_back(std::vector<SimLink>());
+	rx_active.push_back(std::vector<SimRx>());
+	return id;
+}
+
+SimRadio* ChannelSim::radio(int id)
+{
+	return radios[id];
+}
+
+size_t ChannelSim::node_count() const
+{
+	return radios.size();
+}
+
+static void set_link(std::vector<SimLink> &l, int peer, double snr_db)
+{
+	for (size_t i = 0; i < l.size(); ++i) {
+		if (l[i].peer == peer) {
+			l[i].snr_db = snr_db;
+			return;
+		}
+	}
+	l.push_back({peer, snr_db, false});
+}
+
+void ChannelSim::link(int a, int b, double snr_db)
+{
+	if (a == b) {
+		return;
+	}
+	set_link(links[a], b, snr_db);
+	set_link(links[b], a, snr_db);
+}
+
+void ChannelSim::set_error_model(SimErrorModel model)
+{
+	this->model = model;
+}
+
+void ChannelSim::set_burst(double p_good_bad, double p_bad_good, double bad_ber)
+{
+	this->p_good_bad = p_good_bad;
+	this->p_bad_good = p_bad_good;
+	this->bad_ber = bad_ber;
+}
+
+void ChannelSim::set_capture_db(double db)
+{
+	capture_db = db;
+}
+
+uint64_t ChannelSim::now_us()
+{
+	return now;
+}
+
+static inline uint32_t rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+uint32_t ChannelSim::random()
+{
+	uint32_t *s = rng_state;
+	uint32_t res = rotl(s[1] * 5, 7) * 9;
+	uint32_t t = s[1] << 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 11);
+	return res;
+}
+
+double ChannelSim::uniform()
+{
+	return (random() >> 8) * (1.0 / 16777216.0);
+}
+
+void ChannelSim::push(uint64_t time, int type, uint64_t tx, std::function<void()> fn)
+{
+	events.push({time, seq++, type, tx, fn});
+}
+
+void ChannelSim::at(uint64_t time_us, std::function<void()> fn)
+{
+	push(time_us < now ? now : time_us, EV_CALL, 0, fn);
+}
+
+void ChannelSim::run_until(uint64_t time_us)
+{
+	while (!events.empty() && events.top().time <= time_us) {
+		SimEvent ev = events.top();
+		events.pop();
+		now = ev.time;
+		if (ev.type == EV_TX_START) {
+			tx_start(ev.tx);
+		} else if (ev.type == EV_TX_END) {
+			tx_end(ev.tx);
+		} else {
+			ev.fn();
+		}
+	}
+	if (now < time_us) {
+		now = time_us;
+	}
+}
+
+double ChannelSim::snr_floor(int spread)
+{
+	return -7.5 - 2.5 * (spread - 7);
+}
+
+// Rough AWGN waterfall around the demodulation floor. Not a calibrated
+// model of the LoRa PHY, but good enough to exercise FEC.
+double ChannelSim::awgn_ber(double snr_db, int spread) const
+{
+	double margin = pow(10.0, (snr_db - snr_floor(spread)) / 10.0);
+	return 0.5 * erfc(sqrt(2.0 * margin));
+}
+
+// LoRa frames only interfere with frames using the same channel,
+// spreading factor and bandwidth (different SFs are quasi-orthogonal)
+bool ChannelSim::compatible(const SimRadio *a, const SimRadio *b) const
+{
+	return a->band == b->band && a->spread == b->spread && a->bandwidth == b->bandwidth;
+}
+
+void ChannelSim::tx_start(uint64_t tx)
+{
+	SimTx &t = txs[tx];
+	SimRadio *sender = radios[t.node];
+	++tx_frames;
+
+	// half duplex: receptions in course at sender are lost
+	std::vector<SimRx> &own = rx_active[t.node];
+	for (size_t i = 0; i < own.size(); ++i) {
+		own[i].aborted = true;
+	}
+
+	std::vector<SimLink> &l = links[t.node];
+	for (size_t i = 0; i < l.size(); ++i) {
+		int r = l[i].peer;
+		if (!compatible(sender, radios[r])) {
+			continue;
+		}
+		if (radios[r]->transmitting) {
+			++half_duplex;
+			continue;
+		}
+		SimRx rx = {tx, l[i].snr_db, false, false, false};
+		// capture effect: the stronger frame survives a collision
+		// if it is at least capture_db above each of the others
+		std::vector<SimRx> &active = rx_active[r];
+		for (size_t j = 0; j < active.size(); ++j) {
+			rx.overlapped = active[j].overlapped = true;
+			if (rx.snr_db - active[j].snr_db < capture_db) {
+				rx.lost = true;
+			}
+			if (active[j].snr_db - rx.snr_db < capture_db) {
+				active[j].lost = true;
+			}
+		}
+		active.push_back(rx);
+		t.receivers.push_back(r);
+	}
+
+	push(now + LoRaL2::frame_airtime_us(sender->spread, sender->bandwidth,
+				sender->cr4slsh, t.frame.size()),
+		EV_TX_END, tx, 0);
+}
+
+void ChannelSim::tx_end(uint64_t tx)
+{
+	SimTx &t = txs[tx];
+	SimRadio *sender = radios[t.node];
+
+	for (size_t i = 0; i < t.receivers.size(); ++i) {
+		int r = t.receivers[i];
+		std::vector<SimRx> &active = rx_active[r];
+		for (size_t j = 0; j < active.size(); ++j) {
+			if (active[j].tx != tx) {
+				continue;
+			}
+			SimRx rx = active[j];
+			active.erase(active.begin() + j);
+
+			if (rx.aborted) {
+				++half_duplex;
+			} else if (rx.lost) {
+				++collisions;
+			} else if (rx.snr_db < snr_floor(sender->spread)) {
+				++undetected;
+			} else {
+				if (rx.overlapped) ++captures;
+				for (size_t k = 0; k < links[t.node].size(); ++k) {
+					SimLink &lk = links[t.node][k];
+					if (lk.peer == r) {
+						deliver(t, r, rx.snr_db, lk.bad);
+						break;
+					}
+				}
+			}
+			break;
+		}
+	}
+
+	sender->transmitting = false;
+	if (sender->observer) {
+		sender->observer->on_sent();
+	}
+	txs.erase(tx);
+}
+
+void ChannelSim::deliver(SimTx &t, int node, double snr_db, bool &link_bad)
+{
+	SimRadio *radio = radios[node];
+	LoRaL2 *l2 = radio->observer;
+	if (!l2) {
+		return;
+	}
+
+	size_t len = t.frame.size();
+	uint8_t frame[256];
+	memcpy(frame, t.frame.data(), len);
+
+	bool corrupted = false;
+	if (model != SIM_ERR_NONE) {
+		double ber = awgn_ber(snr_db, radio->spread);
+		for (size_t i = 0; i < len; ++i) {
+			double b = ber;
+			if (model == SIM_ERR_BURST) {
+				if (link_bad) {
+					if (uniform() < p_bad_good) link_bad = false;
+				} else {
+					if (uniform() < p_good_bad) link_bad = true;
+				}
+				if (link_bad) b += bad_ber;
+			}
+			if (b < 1e-9) {
+				continue;
+			}
+			for (int bit = 0; bit < 8; ++bit) {
+				if (uniform() < b) {
+					frame[i] ^= 1 << bit;
+					corrupted = true;
+				}
+			}
+		}
+	}
+
+	++rx_frames;
+	if (corrupted) ++rx_corrupted;
+
+	double noise_floor = -174 + 10 * log10((double) radio->bandwidth) + NOISE_FIGURE;
+	LoRaL2RxInfo info;
+	info.rssi = lround(noise_floor + (snr_db > 0 ? snr_db : 0));
+	info.snr = snr_db;
+	info.freq_error = 0;
+	info.time_us = (uint32_t) now;
+
+	radio->fifo = frame;
+	if (l2->deferred_rx()) {
+		uint8_t *slot = l2->on_recv_slot();
+		if (slot) {
+			radio->read(slot, len);
+			l2->on_recv_commit(info, len);
+		}
+		return;
+	}
+
+	uint8_t *buffer = (uint8_t*) malloc(len);
+	radio->read(buffer, len);
+	l2->on_recv(info, buffer, len);
+}
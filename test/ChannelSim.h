@@ -0,0 +1,160 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Discrete-event LoRa channel simulator for testing on UNIX.
+//
+// Drives any number of LoRaL2 instances on a virtual clock, with the
+// real time-on-air of each frame, a topology graph with per-link SNR,
+// collisions with capture effect, and bit error models. Deterministic
+// for a given seed. The simulator is also an ArduinoClock: install it
+// with arduino_set_clock() so arduino_millis() follows simulated time.
+
+#ifndef __CHANNELSIM_H
+#define __CHANNELSIM_H
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <queue>
+#include <functional>
+#include "Radio.h"
+#include "ArduinoBridge.h"
+
+class ChannelSim;
+
+class SimRadio: public RadioDriver {
+public:
+	SimRadio(const SimRadio&) = delete;
+	void operator=(const SimRadio&) = delete;
+
+	SimRadio(ChannelSim *sim, int id);
+
+	virtual bool start(long int band, int spread, int bandwidth, int power,
+			int paboost, int cr4slsh, LoRaL2 *observer);
+	virtual void receive();
+	virtual bool begin_packet();
+	virtual void read(uint8_t* buffer, size_t len);
+	virtual void finish_packet_sg(const RadioFrag* frags, size_t count);
+
+	/* private */
+	ChannelSim *sim;
+	int id;
+	LoRaL2 *observer;
+	long int band;
+	int spread;
+	int bandwidth;
+	int cr4slsh;
+	bool transmitting;
+	const uint8_t* fifo;
+};
+
+enum SimErrorModel {
+	SIM_ERR_NONE,	// frames above sensitivity arrive intact
+	SIM_ERR_AWGN,	// independent bit errors, BER derived from SNR
+	SIM_ERR_BURST	// Gilbert-Elliott: AWGN plus bad-state bursts
+};
+
+struct SimLink {
+	int peer;
+	double snr_db;
+	bool bad;	// Gilbert-Elliott state
+};
+
+struct SimRx {
+	uint64_t tx;
+	double snr_db;
+	bool lost;	// collided
+	bool aborted;	// receiver started to transmit
+	bool overlapped;
+};
+
+struct SimTx {
+	int node;
+	std::vector<uint8_t> frame;
+	std::vector<int> receivers;
+};
+
+struct SimEvent {
+	uint64_t time;
+	uint64_t seq;
+	int type;
+	uint64_t tx;
+	std::function<void()> fn;
+
+	bool operator>(const SimEvent& b) const {
+		return time > b.time || (time == b.time && seq > b.seq);
+	}
+};
+
+class ChannelSim: public ArduinoClock {
+public:
+	ChannelSim(const ChannelSim&) = delete;
+	void operator=(const ChannelSim&) = delete;
+
+	ChannelSim(uint32_t seed);
+	virtual ~ChannelSim();
+
+	// Returns the node id; pass radio(id) to the LoRaL2 constructor
+	int add_node();
+	SimRadio* radio(int id);
+	size_t node_count() const;
+
+	// Symmetric link between two nodes, or SNR update of existing link
+	void link(int a, int b, double snr_db);
+
+	void set_error_model(SimErrorModel model);
+	// Gilbert-Elliott parameters, per octet
+	void set_burst(double p_good_bad, double p_bad_good, double bad_ber);
+	// Minimum power difference for the stronger frame to survive
+	void set_capture_db(double db);
+
+	// Schedules fn to be called at virtual time
+	void at(uint64_t time_us, std::function<void()> fn);
+	// Processes events up to (and including) time_us
+	void run_until(uint64_t time_us);
+	virtual uint64_t now_us();
+
+	// Deterministic PRNG, for test traffic too
+	uint32_t random();
+	double uniform();
+
+	// Demodulation floor, in dB, for a spreading factor
+	static double snr_floor(int spread);
+
+	// Statistics
+	uint32_t tx_frames;
+	uint32_t rx_frames;	// delivered to a stack, corrupted or not
+	uint32_t rx_corrupted;	// delivered with bit errors
+	uint32_t collisions;	// receptions lost to collision
+	uint32_t captures;	// receptions that survived a collision
+	uint32_t half_duplex;	// receptions lost because receiver was transmitting
+	uint32_t undetected;	// receptions below sensitivity
+
+	/* private */
+	void tx_start(uint64_t tx);
+	void tx_end(uint64_t tx);
+	void deliver(SimTx &tx, int node, double snr_db, bool &link_bad);
+	double awgn_ber(double snr_db, int spread) const;
+	void push(uint64_t time, int type, uint64_t tx, std::function<void()> fn);
+	bool compatible(const SimRadio *a, const SimRadio *b) const;
+
+	std::vector<SimRadio*> radios;
+	std::vector<std::vector<SimLink>> links;
+	std::vector<std::vector<SimRx>> rx_active;
+	std::map<uint64_t, SimTx> txs;
+	std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> events;
+	uint64_t now;
+	uint64_t seq;
+	uint64_t next_tx;
+	uint32_t rng_state[4];
+	SimErrorModel model;
+	double p_good_bad;
+	double p_bad_good;
+	double bad_ber;
+	double capture_db;
+};
+
+#endif
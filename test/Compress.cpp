@@ -0,0 +1 @@
+../LoRaL2/Compress.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/Compress.h
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/Dedup.h
\ No newline at end of file
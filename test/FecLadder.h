@@ -0,0 +1 @@
+../LoRaL2/FecLadder.h
\ No newline at end of file
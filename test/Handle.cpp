@@ -0,0 +1 @@
+../LoRaL2/Handle.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/Handle.h
\ No newline at end of file
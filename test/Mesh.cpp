@@ -0,0 +1 @@
+../LoRaL2/Mesh.cpp
\ No newline at end of file
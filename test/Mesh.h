@@ -0,0 +1 @@
+../LoRaL2/Mesh.h
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/Radio.h
\ No newline at end of file
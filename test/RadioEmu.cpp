@@ -0,0 +1,550 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Emulation of LoRa radio and network
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#include "LoRaL2.h"
+#include "ArduinoBridge.h"
+#include "RadioEmu.h"
+
+#define PORT 6000
+#define GROUP "239.0.0.1"
+
+// Datagram: coverage bitmask, sender id (big endian), frame
+#define HDR_LEN 3
+
+RadioEmu::RadioEmu(EmuNet *net, int id)
+{
+	last_sent = 0;
+	last_sent_len = 0;
+	call_onsent = true;
+	sim_senderr = true;
+	this->net = net;
+	node_id = id;
+	coverage = 0;
+	observer = 0;
+	fifo = 0;
+	if (net) {
+		net->attach(this);
+	}
+}
+
+RadioEmu::~RadioEmu()
+{
+	if (net) {
+		net->detach(this);
+	}
+	free(last_sent);
+}
+
+void RadioEmu::set_coverage(int c)
+{
+	coverage = c;
+}
+
+int RadioEmu::id() const
+{
+	return node_id;
+}
+
+bool RadioEmu::start(long int band, int spread, int bandwidth, int power,
+		int paboost, int cr4slsh, LoRaL2 *pobserver)
+{
+	observer = pobserver;
+	return true;
+}
+
+void RadioEmu::receive()
+{
+}
+
+bool RadioEmu::begin_packet()
+{
+	if (sim_senderr) {
+		return arduino_random(0, 100) > 0;
+	}
+	return true;
+}
+
+void RadioEmu::finish_packet_sg(const RadioFrag* frags, size_t count)
+{
+	if (last_sent) {
+		free(last_sent);
+		last_sent = 0;
+	}
+	size_t len = 0;
+	for (size_t i = 0; i < count; ++i) {
+		len += frags[i].len;
+	}
+	uint8_t *packet = last_sent = (uint8_t*) malloc(len);
+	for (size_t i = 0, pos = 0; i < count; pos += frags[i].len, ++i) {
+		memcpy(packet + pos, frags[i].data, frags[i].len);
+	}
+	last_sent_len = len;
+
+	if (net && net->queue(this, frags, count)) {
+		// on_sent() is called when the batch is actually sent
+		return;
+	}
+	if (call_onsent) {
+		observer->on_sent();
+	}
+}
+
+void RadioEmu::read(uint8_t* buffer, size_t len)
+{
+	memcpy(buffer, fifo, len);
+	fifo += len;
+}
+
+void RadioEmu::deliver(const uint8_t* frame, size_t len, int rssi)
+{
+	if (!observer) {
+		return;
+	}
+
+#ifdef LORA_EMU_DUMP
+	printf("fake: lora_emu_rx ");
+	for(size_t i = 0; i < len; ++i) {
+		printf("%d ", frame[i]);
+	}
+	printf("\n");
+#endif
+
+	fifo = frame;
+
+	if (observer->deferred_rx()) {
+		uint8_t *slot = observer->on_recv_slot();
+		if (slot) {
+			read(slot, len);
+			observer->on_recv_commit(rssi, len);
+		}
+		return;
+	}
+
+	uint8_t* bmsg = (uint8_t*) malloc(len);
+	read(bmsg, len);
+	observer->on_recv(rssi, bmsg, len);
+}
+
+EmuNet::EmuNet()
+{
+	sock = -1;
+	epfd = -1;
+	log = false;
+	tx_count = 0;
+}
+
+EmuNet::~EmuNet()
+{
+	flush();
+	if (epfd >= 0) {
+		close(epfd);
+	}
+	if (sock >= 0) {
+		close(sock);
+	}
+}
+
+int EmuNet::fd() const
+{
+	return sock;
+}
+
+void EmuNet::set_log(bool on)
+{
+	log = on;
+}
+
+bool EmuNet::open()
+{
+	// from https://web.cs.wpi.edu/~claypool/courses/4514-B99/samples/multicast.c
+	struct ip_mreq mreq;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("fake: socket");
+		return false;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	// Self-receive must be enabled because we run multiple instances
+	// on the same machine
+	int loop = 1;
+	if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+		perror("fake: setsockopt loop");
+		return false;
+	}
+
+	// Allow multiple listeners to the same port
+	int optval = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+		perror("fake: setsockopt reuseport");
+		return false;
+	}
+
+	// Bursts from hundreds of nodes
+	int bufsize = 4 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+	// Enter multicast group
+	mreq.imr_multiaddr.s_addr = inet_addr(GROUP);
+	mreq.imr_interface.s_addr = INADDR_ANY;
+	if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+					&mreq, sizeof(mreq)) < 0) {
+		perror("fake: setsockopt mreq");
+		return false;
+	}
+
+	// listen UDP port
+	struct sockaddr_in addr;
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(PORT);
+
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("fake: bind");
+		return false;
+	}
+
+#if defined(__linux__)
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("fake: epoll_create1");
+		return false;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+		perror("fake: epoll_ctl");
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+void EmuNet::attach(RadioEmu *node)
+{
+	nodes.push_back(node);
+	std::map<int, int>::iterator c = node_coverage.find(node->id());
+	if (c != node_coverage.end()) {
+		node->set_coverage(c->second);
+	}
+}
+
+void EmuNet::detach(RadioEmu *node)
+{
+	for (size_t i = 0; i < tx_count; ++i) {
+		if (tx[i].sender == node) {
+			tx[i].sender = 0;
+		}
+	}
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		if (nodes[i] == node) {
+			nodes.erase(nodes.begin() + i);
+			break;
+		}
+	}
+}
+
+void EmuNet::add_link(int from, int to, double loss, int corrupt, int rssi)
+{
+	links.push_back({from, to, loss, corrupt, rssi});
+}
+
+bool EmuNet::load_topology(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror("fake: topology");
+		return false;
+	}
+
+	char line[256];
+	int lineno = 0;
+	bool ok = true;
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		char *comment = strchr(line, '#');
+		if (comment) *comment = 0;
+
+		char kind[16];
+		if (sscanf(line, "%15s", kind) != 1) {
+			continue;
+		}
+
+		int id, coverage, from, to, corrupt, rssi = -50;
+		double loss;
+		if (!strcmp(kind, "node") &&
+				sscanf(line, "%*s %d %i", &id, &coverage) == 2) {
+			node_coverage[id] = coverage;
+			for (size_t i = 0; i < nodes.size(); ++i) {
+				if (nodes[i]->id() == id) {
+					nodes[i]->set_coverage(coverage);
+				}
+			}
+		} else if (!strcmp(kind, "link") &&
+				sscanf(line, "%*s %d %d %lf %d %d",
+					&from, &to, &loss, &corrupt, &rssi) >= 4) {
+			add_link(from, to, loss, corrupt, rssi);
+		} else {
+			fprintf(stderr, "fake: %s:%d: bad topology entry\n", path, lineno);
+			ok = false;
+		}
+	}
+
+	fclose(f);
+	return ok;
+}
+
+bool EmuNet::has_links(int from) const
+{
+	for (size_t i = 0; i < links.size(); ++i) {
+		if (links[i].from == from) return true;
+	}
+	return false;
+}
+
+const EmuLink* EmuNet::find_link(int from, int to) const
+{
+	for (size_t i = 0; i < links.size(); ++i) {
+		if (links[i].from == from && links[i].to == to) return &links[i];
+	}
+	return 0;
+}
+
+// Frames longer than a LoRa frame are rejected
+bool EmuNet::queue(RadioEmu *sender, const RadioFrag* frags, size_t count)
+{
+	size_t len = 0;
+	for (size_t i = 0; i < count; ++i) {
+		len += frags[i].len;
+	}
+	if (len > LORAL2_MAX_FRAME) {
+		if (log) printf("fake: frame too long (%lu), not sent\n", (unsigned long) len);
+		return false;
+	}
+
+	if (tx_count >= EMU_BATCH) {
+		flush();
+	}
+
+	EmuDatagram &d = tx[tx_count++];
+	d.sender = sender;
+	d.buf[0] = sender->coverage;
+	d.buf[1] = sender->id() >> 8;
+	d.buf[2] = sender->id() & 0xff;
+	d.len = HDR_LEN;
+	for (size_t i = 0; i < count; ++i) {
+		memcpy(d.buf + d.len, frags[i].data, frags[i].len);
+		d.len += frags[i].len;
+	}
+
+#ifdef LORA_EMU_DUMP
+	printf("fake: lora_emu_tx ");
+	for(size_t i = 0; i < d.len; ++i) {
+		printf("%d ", d.buf[i]);
+	}
+	printf("\n");
+#endif
+	return true;
+}
+
+void EmuNet::flush()
+{
+	if (!tx_count) {
+		return;
+	}
+
+	// Send to multicast group & port
+	struct sockaddr_in addr;
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(GROUP);
+	addr.sin_port = htons(PORT);
+
+	size_t sent = 0;
+#if defined(__linux__)
+	struct mmsghdr msgs[EMU_BATCH];
+	struct iovec iov[EMU_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for (size_t i = 0; i < tx_count; ++i) {
+		iov[i].iov_base = tx[i].buf;
+		iov[i].iov_len = tx[i].len;
+		msgs[i].msg_hdr.msg_name = &addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (sent < tx_count) {
+		int n = sendmmsg(sock, msgs + sent, tx_count - sent, 0);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) continue;
+			perror("fake: sendmmsg");
+			exit(1);
+		}
+		sent += n;
+	}
+#else
+	for (; sent < tx_count; ++sent) {
+		if (sendto(sock, tx[sent].buf, tx[sent].len, 0,
+				(struct sockaddr *) &addr, sizeof(addr)) < 0) {
+			perror("fake: sendto");
+			exit(1);
+		}
+	}
+#endif
+
+	if (log) {
+		printf("fake: sent %lu frames\n", (unsigned long) sent);
+	}
+
+	// on_sent() may queue more frames
+	size_t count = tx_count;
+	RadioEmu *senders[EMU_BATCH];
+	for (size_t i = 0; i < count; ++i) {
+		senders[i] = tx[i].sender;
+	}
+	tx_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (senders[i] && senders[i]->call_onsent && senders[i]->observer) {
+			senders[i]->observer->on_sent();
+		}
+	}
+}
+
+void EmuNet::dispatch(const uint8_t *buf, size_t len)
+{
+	// receive buffers have room for one extra octet, to tell oversize
+	// datagrams from truncated ones
+	if (len < HDR_LEN || len - HDR_LEN > LORAL2_MAX_FRAME) {
+		if (log) printf("fake: dropped datagram of %lu octets\n", (unsigned long) len);
+		return;
+	}
+	int cov = buf[0];
+	int from = (buf[1] << 8) | buf[2];
+	const uint8_t *frame = buf + HDR_LEN;
+	len -= HDR_LEN;
+	bool linked = has_links(from);
+
+	// nodes may be detached by the callbacks
+	std::vector<RadioEmu*> targets = nodes;
+	for (size_t i = 0; i < targets.size(); ++i) {
+		RadioEmu *node = targets[i];
+		if (node->id() == from) {
+			continue;
+		}
+
+		int corrupt = 0;
+		int rssi = -50;
+		if (linked) {
+			const EmuLink *l = find_link(from, node->id());
+			if (!l) {
+				continue;
+			}
+			if (l->loss > 0 && arduino_random(0, 1000000) < l->loss * 1000000) {
+				if (log) printf("fake: %d -> %d lost\n", from, node->id());
+				continue;
+			}
+			corrupt = l->corrupt;
+			rssi = l->rssi;
+		} else if (! (cov & node->coverage)) {
+			continue;
+		}
+
+		uint8_t copy[LORAL2_MAX_FRAME];
+		memcpy(copy, frame, len);
+		for (int c = 0; c < corrupt && len > 0; ++c) {
+			copy[arduino_random(0, len)] = arduino_random(0, 256);
+		}
+		if (log) {
+			printf("fake: %d -> %d len %lu, %d octets corrupted\n",
+				from, node->id(), (unsigned long) len, corrupt);
+		}
+		node->deliver(copy, len, rssi);
+	}
+}
+
+size_t EmuNet::poll(int timeout_ms)
+{
+	flush();
+
+#if defined(__linux__)
+	struct epoll_event ev;
+	if (epoll_wait(epfd, &ev, 1, timeout_ms) <= 0) {
+		return 0;
+	}
+
+	size_t total = 0;
+	struct mmsghdr msgs[EMU_BATCH];
+	struct iovec iov[EMU_BATCH];
+	uint8_t bufs[EMU_BATCH][HDR_LEN + LORAL2_MAX_FRAME + 1];
+	for (;;) {
+		memset(msgs, 0, sizeof(msgs));
+		for (size_t i = 0; i < EMU_BATCH; ++i) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = sizeof(bufs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(sock, msgs, EMU_BATCH, MSG_DONTWAIT, 0);
+		if (n <= 0) {
+			if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("fake: recvmmsg");
+				exit(1);
+			}
+			break;
+		}
+		for (int i = 0; i < n; ++i) {
+			dispatch(bufs[i], msgs[i].msg_len);
+		}
+		total += n;
+		// frames sent by the callbacks
+		flush();
+	}
+	return total;
+#else
+	struct pollfd pfd = {sock, POLLIN, 0};
+	if (::poll(&pfd, 1, timeout_ms) <= 0) {
+		return 0;
+	}
+
+	size_t total = 0;
+	uint8_t buf[HDR_LEN + LORAL2_MAX_FRAME + 1];
+	for (;;) {
+		ssize_t n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				perror("fake: recv");
+				exit(1);
+			}
+			break;
+		}
+		dispatch(buf, n);
+		++total;
+		flush();
+	}
+	return total;
+#endif
+}
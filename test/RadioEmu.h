@@ -0,0 +1,128 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Radio emulator for testing on UNIX. Nodes attached to an EmuNet
+// exchange frames over UDP multicast, so many nodes in the same process,
+// and many processes in the same machine, see each other.
+
+#ifndef __RADIOEMU_H
+#define __RADIOEMU_H
+
+#include <vector>
+#include <map>
+#include "Radio.h"
+#include "RxRing.h"
+
+class EmuNet;
+
+class RadioEmu: public RadioDriver {
+public:
+	RadioEmu(const RadioEmu&) = delete;
+	void operator=(const RadioEmu&) = delete;
+
+	// Without a network, frames are only copied to last_sent.
+	// Node ids must be unique among all processes sharing the network.
+	RadioEmu(EmuNet *net = 0, int id = 0);
+	virtual ~RadioEmu();
+
+	virtual bool start(long int band, int spread, int bandwidth, int power,
+			int paboost, int cr4slsh, LoRaL2 *observer);
+	virtual void receive();
+	virtual bool begin_packet();
+	virtual void read(uint8_t* buffer, size_t len);
+	virtual void finish_packet_sg(const RadioFrag* frags, size_t count);
+
+	// Hands a received frame to the stack
+	void deliver(const uint8_t* frame, size_t len, int rssi);
+
+	// simulate different coverage areas
+	// e.g. packet sent to coverage 0x01 is seen by stations
+	// with coverage 0x03 but not by stations with cov. 0x02
+	void set_coverage(int c);
+	int id() const;
+
+	// copy of the last frame sent
+	uint8_t* last_sent;
+	size_t last_sent_len;
+	// call LoRaL2::on_sent() right after sending
+	bool call_onsent;
+	// begin_packet() fails randomly
+	bool sim_senderr;
+
+	/* private */
+	EmuNet *net;
+	int node_id;
+	int coverage;
+	LoRaL2 *observer;
+	// emulated radio FIFO, pointing to the frame being received
+	const uint8_t* fifo;
+};
+
+// Link quality between two nodes
+struct EmuLink {
+	int from;
+	int to;
+	double loss;	// probability of frame loss
+	int corrupt;	// octets corrupted per frame
+	int rssi;
+};
+
+// Maximum datagrams per recvmmsg()/sendmmsg() call
+#define EMU_BATCH 32
+
+struct EmuDatagram {
+	uint8_t buf[3 + LORAL2_MAX_FRAME];
+	size_t len;
+	RadioEmu *sender;
+};
+
+// Event loop hosting many emulated nodes, on a single non-blocking
+// multicast socket (epoll, recvmmsg and sendmmsg on Linux)
+class EmuNet {
+public:
+	EmuNet(const EmuNet&) = delete;
+	void operator=(const EmuNet&) = delete;
+
+	EmuNet();
+	virtual ~EmuNet();
+
+	// Opens the socket; returns false on error
+	bool open();
+	int fd() const;
+
+	// Text file, one entry per line, '#' starts a comment:
+	//	node <id> <coverage>
+	//	link <from> <to> <loss> <corrupt octets> [rssi]
+	// Nodes with links only reach their linked peers; the others use
+	// the coverage bitmask.
+	bool load_topology(const char *path);
+	void add_link(int from, int to, double loss, int corrupt, int rssi = -50);
+	void set_log(bool on);
+
+	// Sends queued frames, then waits up to timeout_ms for frames and
+	// dispatches them to the attached nodes. Returns frames received.
+	size_t poll(int timeout_ms);
+	// Sends queued frames
+	void flush();
+
+	/* private */
+	void attach(RadioEmu *node);
+	void detach(RadioEmu *node);
+	bool queue(RadioEmu *sender, const RadioFrag* frags, size_t count);
+	void dispatch(const uint8_t *buf, size_t len);
+	bool has_links(int from) const;
+	const EmuLink* find_link(int from, int to) const;
+
+	int sock;
+	int epfd;
+	bool log;
+	std::vector<RadioEmu*> nodes;
+	std::vector<EmuLink> links;
+	std::map<int, int> node_coverage;	// from topology
+	EmuDatagram tx[EMU_BATCH];
+	size_t tx_count;
+};
+
+#endif
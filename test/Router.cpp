@@ -0,0 +1 @@
+../LoRaL2/Router.cpp
\ No newline at end of file
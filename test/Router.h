@@ -0,0 +1 @@
+../LoRaL2/Router.h
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/RxRing.h
\ No newline at end of file
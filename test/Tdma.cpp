@@ -0,0 +1 @@
+../LoRaL2/Tdma.cpp
\ No newline at end of file
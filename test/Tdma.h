@@ -0,0 +1 @@
+../LoRaL2/Tdma.h
\ No newline at end of file
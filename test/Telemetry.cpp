@@ -0,0 +1 @@
+../LoRaL2/Telemetry.cpp
\ No newline at end of file
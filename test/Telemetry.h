@@ -0,0 +1 @@
+../LoRaL2/Telemetry.h
\ No newline at end of file
@@ -0,0 +1 @@
+../LoRaL2/Trace.cpp
\ No newline at end of file
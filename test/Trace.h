@@ -0,0 +1 @@
+../LoRaL2/Trace.h
\ No newline at end of file
@@ -0,0 +1,27 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Compile-only check: the FEC headers must build as C++11, as on AVR
+// and ESP32 core 1.x. See the cxx11 target.
+
+#include "FecLadder.h"
+
+typedef FecLadder<FecCode<50, 10>, FecCode<100, 14>, FecCode<230, 20>> Ladder;
+
+static_assert(RS::gf::field::tables.exp[1] == 2, "GF exp table");
+static_assert(RS::gf::field::tables.exp[8] == 0x1d, "GF exp table");
+static_assert(RS::gf::field::tables.exp[255 + 8] == 0x1d, "GF exp table");
+static_assert(RS::gf::field::tables.log[0x1d] == 8, "GF log table");
+
+int main()
+{
+	uint8_t padded[Ladder::max_k] = {0};
+	uint8_t msg[Ladder::max_k];
+	uint8_t ecc[Ladder::max_parity];
+	size_t net_len;
+
+	Ladder::encode(padded, 10, ecc);
+	return Ladder::decode(padded, 60, padded, msg, net_len);
+}
@@ -0,0 +1,175 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Monte Carlo frame error rate of the FEC pipeline (append_fec/decode_fec),
+// as a function of symbol error probability, burst length and payload size
+// (which selects the RS code). Prints CSV to stdout, uses all cores.
+//
+// Usage: ./fer [trials per point] [threads]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "LoRaL2.h"
+#include "RadioEmu.h"
+#include "FecLadder.h"
+
+static const size_t payloads[] = {10, 30, 50, 51, 75, 100, 101, 160, 230};
+static const double symbol_errors[] = {0.001, 0.005, 0.01, 0.02, 0.03, 0.05, 0.08, 0.1};
+static const int bursts[] = {1, 2, 4, 8};
+
+#define N_PAYLOADS (sizeof(payloads) / sizeof(payloads[0]))
+#define N_SYMBOL_ERRORS (sizeof(symbol_errors) / sizeof(symbol_errors[0]))
+#define N_BURSTS (sizeof(bursts) / sizeof(bursts[0]))
+
+struct FerPoint {
+	size_t payload;
+	double p;
+	int burst;
+	uint32_t failed;	// decoder reported error
+	uint32_t miscorrected;	// decoder reported success, wrong data
+	double cpu_us;
+};
+
+static std::vector<FerPoint> points;
+static size_t next_point = 0;
+static int trials = 2000;
+
+// xorshift32, one state per point, so results do not depend
+// on thread scheduling
+static inline uint32_t rnd(uint32_t &s)
+{
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	return s;
+}
+
+static inline double rnd_uniform(uint32_t &s)
+{
+	return (rnd(s) >> 8) * (1.0 / 16777216.0);
+}
+
+static double thread_cpu_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+// Bursts start with probability p / burst per symbol, so the average
+// symbol error rate is about p regardless of burst length
+static void corrupt(uint8_t *frame, size_t len, double p, int burst, uint32_t &s)
+{
+	double p_start = p / burst;
+	for (size_t i = 0; i < len; ++i) {
+		if (rnd_uniform(s) < p_start) {
+			for (size_t j = i; j < i + burst && j < len; ++j) {
+				// a symbol error never leaves the symbol intact
+				frame[j] ^= 1 + rnd(s) % 255;
+			}
+			// next burst may start right after this one
+			i += burst - 1;
+		}
+	}
+}
+
+static void run_point(LoRaL2 *l2, FerPoint &pt, uint32_t seed)
+{
+	uint32_t s = seed | 1;
+	uint8_t payload[256];
+	double cpu = 0;
+
+	for (int t = 0; t < trials; ++t) {
+		for (size_t i = 0; i < pt.payload; ++i) {
+			payload[i] = rnd(s);
+		}
+		size_t fec_len;
+		uint8_t *frame = l2->append_fec(payload, pt.payload, fec_len);
+		corrupt(frame, fec_len, pt.p, pt.burst, s);
+
+		size_t dec_len;
+		int err;
+		double t0 = thread_cpu_us();
+		uint8_t *dec = l2->decode_fec(frame, fec_len, dec_len, err);
+		cpu += thread_cpu_us() - t0;
+
+		if (err) {
+			++pt.failed;
+		} else if (dec_len != pt.payload || memcmp(dec, payload, dec_len)) {
+			++pt.miscorrected;
+		}
+		free(dec);
+		free(frame);
+	}
+
+	pt.cpu_us = cpu / trials;
+}
+
+static void worker()
+{
+	RadioEmu radio;
+	LoRaL2 l2(&radio, 915000000, 7, 125000, 0, 0, 0);
+
+	for (;;) {
+		size_t i = __atomic_fetch_add(&next_point, 1, __ATOMIC_RELAXED);
+		if (i >= points.size()) {
+			break;
+		}
+		run_point(&l2, points[i], 0x9e3779b9 * (i + 1));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int threads = std::thread::hardware_concurrency();
+	if (argc > 1) trials = atoi(argv[1]);
+	if (argc > 2) threads = atoi(argv[2]);
+	if (trials < 1) trials = 1;
+	if (threads < 1) threads = 1;
+
+	for (size_t i = 0; i < N_PAYLOADS; ++i) {
+		for (size_t j = 0; j < N_SYMBOL_ERRORS; ++j) {
+			for (size_t k = 0; k < N_BURSTS; ++k) {
+				if (payloads[i] > LoRaL2Fec::max_k) {
+					continue;
+				}
+				FerPoint pt;
+				memset(&pt, 0, sizeof(pt));
+				pt.payload = payloads[i];
+				pt.p = symbol_errors[j];
+				pt.burst = bursts[k];
+				points.push_back(pt);
+			}
+		}
+	}
+
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; ++t) {
+		pool.push_back(std::thread(worker));
+	}
+	for (int t = 0; t < threads; ++t) {
+		pool[t].join();
+	}
+
+	printf("code,payload,symbol_error_p,burst_len,trials,fer,miscorrection_rate,decode_us\n");
+	for (size_t i = 0; i < points.size(); ++i) {
+		FerPoint &pt = points[i];
+		size_t k = LoRaL2Fec::code_k(pt.payload);
+		printf("\"RS(%lu,%lu)\",%lu,%g,%d,%d,%g,%g,%.2f\n",
+			(unsigned long) (k + LoRaL2Fec::parity_len(pt.payload)),
+			(unsigned long) k,
+			(unsigned long) pt.payload, pt.p, pt.burst, trials,
+			(double) (pt.failed + pt.miscorrected) / trials,
+			(double) pt.miscorrected / trials,
+			pt.cpu_us);
+	}
+
+	return 0;
+}
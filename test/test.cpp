@@ -1,19 +1,32 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <cmath>
+#include <utility>
 
 #include "LoRaL2.h"
 #include "ArduinoBridge.h"
-
-extern uint8_t* lora_test_last_sent;
-extern int lora_test_last_sent_len;
-extern bool lora_emu_call_onsent;
-extern bool lora_emu_sim_senderr;
+#include "AES.h"
+#include "AESFast.h"
+#include "RS-FEC.h"
+#include "RxRing.h"
+#include "Dedup.h"
+#include "Mesh.h"
+#include "Router.h"
+#include "Handle.h"
+#include "RadioEmu.h"
+#include "ChannelSim.h"
+#include "FecLadder.h"
+#include "Trace.h"
+#include "Compress.h"
+#include "Telemetry.h"
+#include "Tdma.h"
 
 static uint8_t* test_payload;
 static size_t test_len;
 static int test_exp_err_min;
 static int test_exp_err_max;
+static int test_recv_count = 0;
 
 static uint8_t* memdup(const uint8_t* buffer, size_t len)
 {
@@ -27,6 +40,7 @@ class TestObserver: public LoRaL2Observer
 public:
 virtual void recv(LoRaL2Packet *pkt)
 {
+	++test_recv_count;
 	printf("\tReceived len %lu err %d\n", pkt->len, pkt->err);
 	if (pkt->err < test_exp_err_min || pkt->err > test_exp_err_max) {
 		printf("\t\tUnexpected error %d, expected %d..%d\n",
@@ -55,9 +69,57 @@ static TestObserver *observer = 0;
 #define SPREAD 7
 #define BWIDTH 125000
 
+// send() does not call on_sent(), and never fails
+static void quiet_radio(RadioEmu &radio)
+{
+	radio.call_onsent = false;
+	radio.sim_senderr = false;
+}
+
+// Encrypted stack on a quiet radio, reporting to observer
+static LoRaL2 *keyed_l2(RadioEmu &radio)
+{
+	quiet_radio(radio);
+	return new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
+			"abracadabra", strlen("abracadabra"),
+			observer);
+}
+
+// Sends a random test_payload of len octets, which observer expects back
+// intact; the frame is left in the radio's last_sent
+static void loopback_frame(LoRaL2 *l2, size_t len)
+{
+	test_len = len;
+	test_payload = (uint8_t*) malloc(test_len);
+	for (size_t i = 0; i < test_len; ++i) {
+		test_payload[i] = random() % 256;
+	}
+	l2->send(test_payload, test_len);
+	l2->on_sent();
+	test_exp_err_min = test_exp_err_max = 0;
+	test_recv_count = 0;
+}
+
+// Hands n copies of the last frame sent by radio to the deferred RX path
+// of l2; returns how many found a slot
+static int inject_deferred(LoRaL2 *l2, RadioEmu &radio, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		uint8_t *slot = l2->on_recv_slot();
+		if (!slot) {
+			return i;
+		}
+		memcpy(slot, radio.last_sent, radio.last_sent_len);
+		l2->on_recv_commit(-50, radio.last_sent_len);
+	}
+	return n;
+}
+
 static void test_1(const char *key)
 {
-	LoRaL2* l2 = new LoRaL2(BAND, SPREAD, BWIDTH,
+	RadioEmu radio;
+	quiet_radio(radio);
+	LoRaL2* l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
 			key, key ? strlen(key) : 0,
 			observer);
 	printf("Status %d, Speed in bps: %d\n", !!l2->ok(), l2->speed_bps());
@@ -97,37 +159,25 @@ static void test_1(const char *key)
 
 		// reception of perfect packet
 		test_exp_err_min = test_exp_err_max = 0;
-		recv_len = lora_test_last_sent_len;
-		recv_buffer = memdup(lora_test_last_sent, recv_len);
+		recv_len = radio.last_sent_len;
+		recv_buffer = memdup(radio.last_sent, recv_len);
 		printf("\tReceiving len %lu\n", recv_len);
 		l2->on_recv(-50, recv_buffer, recv_len);
 
 		// light data corrruption
 		test_exp_err_min = test_exp_err_max = 0;
-		recv_len = lora_test_last_sent_len;
-		recv_buffer = memdup(lora_test_last_sent, recv_len);
-		for (size_t i = 0; i < 5; ++i) {
+		recv_len = radio.last_sent_len;
+		recv_buffer = memdup(radio.last_sent, recv_len);
+		for (size_t i = 0; i < LoRaL2Fec::min_parity / 2; ++i) {
 			recv_buffer[random() % recv_len] = random() % 256;
 		}
 		printf("\tReceiving LDR len %lu\n", recv_len);
 		l2->on_recv(-50, recv_buffer, recv_len);
 
-		// severe data corrruption
-		if (key) {
-			// final L1 size boring to estimate because of encryption block
-			test_exp_err_min = 996;
-			test_exp_err_max = 998;
-		} else {
-			if (test_len <= 50) {
-				test_exp_err_min = test_exp_err_max = 998;
-			} else if (test_len <= 100) {
-				test_exp_err_min = test_exp_err_max = 997;
-			} else {
-				test_exp_err_min = test_exp_err_max = 996;
-			}
-		}
-		recv_len = lora_test_last_sent_len;
-		recv_buffer = memdup(lora_test_last_sent, recv_len);
+		// severe data corrruption, fails at the tier given by L1 size
+		recv_len = radio.last_sent_len;
+		test_exp_err_min = test_exp_err_max = FEC_ERR_TIER0 - LoRaL2Fec::tier(recv_len);
+		recv_buffer = memdup(radio.last_sent, recv_len);
 		for (size_t i = 0; i < 30; ++i) {
 			recv_buffer[random() % recv_len] = random() % 256;
 		}
@@ -135,22 +185,22 @@ static void test_1(const char *key)
 		l2->on_recv(-50, recv_buffer, recv_len);
 
 		// short packet FEC
-		test_exp_err_min = test_exp_err_max = 999;
-		recv_len = 9;
+		test_exp_err_min = test_exp_err_max = FEC_ERR_LENGTH;
+		recv_len = LoRaL2Fec::min_parity - 1;
 		recv_buffer = (uint8_t*) malloc(recv_len);
 		printf("\tReceiving short len %lu\n", recv_len);
 		l2->on_recv(-50, recv_buffer, recv_len);
 
 		// long packet FEC
-		test_exp_err_min = test_exp_err_max = 999;
+		test_exp_err_min = test_exp_err_max = FEC_ERR_LENGTH;
 		recv_len = 300;
 		recv_buffer = (uint8_t*) malloc(recv_len);
 		printf("\tReceiving long len %lu\n", recv_len);
 		l2->on_recv(-50, recv_buffer, recv_len);
 
 		// cleanup
-		free(lora_test_last_sent);
-		lora_test_last_sent = 0;
+		free(radio.last_sent);
+		radio.last_sent = 0;
 		free(test_payload);
 	}
 
@@ -178,7 +228,9 @@ static const char *hc_unenc = "highcastle";
 
 static void test_encryption()
 {
-	LoRaL2* l2 = new LoRaL2(BAND, SPREAD, BWIDTH,
+	RadioEmu radio;
+	quiet_radio(radio);
+	LoRaL2* l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
 			"abracadabra", strlen("abracadabra"),
 			0);
 
@@ -231,16 +283,1985 @@ static void test_encryption()
 	delete l2;
 }
 
-int main()
+// RX callback only queues frames, poll() processes them
+static void test_deferred()
 {
-	// calls srandom(time of day) indirectly
-	arduino_random(0, 2);
+	RadioEmu radio;
+	LoRaL2* l2 = keyed_l2(radio);
+	l2->set_deferred_rx(true);
+	loopback_frame(l2, 20);
+
+	// overflow the ring by one frame
+	if (inject_deferred(l2, radio, LORAL2_RX_SLOTS + 1) != LORAL2_RX_SLOTS) {
+		printf("Deferred RX: ring full too early\n");
+		exit(1);
+	}
+	if (l2->rx_dropped() != 1) {
+		printf("Deferred RX: unexpected drop count %u\n", l2->rx_dropped());
+		exit(1);
+	}
+	size_t n = l2->poll();
+	if (n != LORAL2_RX_SLOTS || test_recv_count != LORAL2_RX_SLOTS) {
+		printf("Deferred RX: polled %lu, received %d\n", n, test_recv_count);
+		exit(1);
+	}
+	if (l2->poll() != 0) {
+		printf("Deferred RX: ring not empty after poll\n");
+		exit(1);
+	}
+
+	free(test_payload);
+	delete l2;
+}
+
+static void dedup_recv(LoRaL2 *l2, const uint8_t *frame, size_t len)
+{
+	l2->on_recv(-50, memdup(frame, len), len);
+}
+
+static void test_dedup()
+{
+	ArduinoVirtualClock clock(1000000);
+	arduino_set_clock(&clock);
+
+	RadioEmu radio;
+	LoRaL2* l2 = keyed_l2(radio);
+	l2->set_dedup(10000);
+
+	loopback_frame(l2, 40);
+	uint8_t *first = memdup(radio.last_sent, radio.last_sent_len);
+	size_t first_len = radio.last_sent_len;
+	free(radio.last_sent);
+	radio.last_sent = 0;
+
+	dedup_recv(l2, first, first_len);
+	// same frame from a relay, then with a correctable error
+	clock.advance(2000000);
+	dedup_recv(l2, first, first_len);
+	first[3] ^= 0xff;
+	dedup_recv(l2, first, first_len);
+	first[3] ^= 0xff;
+	if (test_recv_count != 1 || l2->dedup_hits() != 2 || l2->dedup_misses() != 1) {
+		printf("Dedup: received %d, hits %u, misses %u\n", test_recv_count,
+			l2->dedup_hits(), l2->dedup_misses());
+		exit(1);
+	}
+
+	// another packet with same payload has another IV, so it is not a dup
+	l2->send(test_payload, test_len);
+	l2->on_sent();
+	dedup_recv(l2, radio.last_sent, radio.last_sent_len);
+	free(radio.last_sent);
+	radio.last_sent = 0;
+	if (test_recv_count != 2) {
+		printf("Dedup: distinct frame dropped\n");
+		exit(1);
+	}
+
+	// window expired
+	clock.advance(9000000);
+	dedup_recv(l2, first, first_len);
+	if (test_recv_count != 3 || l2->dedup_misses() != 3) {
+		printf("Dedup: frame not accepted after window\n");
+		exit(1);
+	}
+
+	// failed frames are not deduplicated
+	test_exp_err_min = FEC_ERR_LENGTH;
+	test_exp_err_max = FEC_ERR_LENGTH;
+	dedup_recv(l2, first, 3);
+	dedup_recv(l2, first, 3);
+	if (test_recv_count != 5) {
+		printf("Dedup: FEC failures not delivered\n");
+		exit(1);
+	}
+
+	// deferred path, and the ring wraps around
+	l2->set_dedup(10000);
+	l2->set_deferred_rx(true);
+	test_exp_err_min = test_exp_err_max = 0;
+	test_recv_count = 0;
+	for (int n = 0; n < LORAL2_DEDUP_SLOTS + 1; ++n) {
+		l2->send(test_payload, test_len);
+		l2->on_sent();
+		inject_deferred(l2, radio, 2);
+		free(radio.last_sent);
+		radio.last_sent = 0;
+		l2->poll();
+	}
+	if (test_recv_count != LORAL2_DEDUP_SLOTS + 1 ||
+			l2->dedup_hits() != LORAL2_DEDUP_SLOTS + 1) {
+		printf("Dedup: deferred received %d hits %u\n", test_recv_count,
+			l2->dedup_hits());
+		exit(1);
+	}
+
+	free(first);
+	free(test_payload);
+	delete l2;
+	arduino_set_clock(0);
+}
+
+class AddrObserver: public LoRaL2Observer
+{
+public:
+	AddrObserver(): count(0), err(0), len(0), src(0), dst(0) {}
+	virtual void recv(LoRaL2Packet *pkt)
+	{
+		++count;
+		err = pkt->err;
+		len = pkt->len;
+		src = pkt->src;
+		dst = pkt->dst;
+		delete pkt;
+	}
+	int count;
+	int err;
+	size_t len;
+	uint16_t src;
+	uint16_t dst;
+};
+
+// Sends with 'from' and hands the frame to 'to'
+static void addr_xfer(RadioEmu &radio, LoRaL2 *from, LoRaL2 *to, uint16_t dst,
+		const uint8_t *payload, size_t len)
+{
+	if (!from->send_to(dst, payload, len)) {
+		printf("Addressing: send failed\n");
+		exit(1);
+	}
+	from->on_sent();
+	if (radio.last_sent_len != from->frame_len(len)) {
+		printf("Addressing: frame length %lu, expected %lu\n",
+			(unsigned long) radio.last_sent_len,
+			(unsigned long) from->frame_len(len));
+		exit(1);
+	}
+	to->on_recv(-50, radio.last_sent, radio.last_sent_len);
+	radio.last_sent = 0;
+}
+
+// Frames for other nodes are dropped before decryption
+static void test_addressing()
+{
+	RadioEmu radio;
+	quiet_radio(radio);
+	AddrObserver obs_a, obs_b, obs_c;
+	LoRaL2 a(&radio, BAND, SPREAD, BWIDTH, "abracadabra", strlen("abracadabra"), &obs_a);
+	LoRaL2 b(&radio, BAND, SPREAD, BWIDTH, "abracadabra", strlen("abracadabra"), &obs_b);
+	LoRaL2 c(&radio, BAND, SPREAD, BWIDTH, "abracadabra", strlen("abracadabra"), &obs_c);
+	size_t plain_max = a.max_payload();
+	a.set_address(1);
+	b.set_address(2);
+	c.set_address(3);
+	if (a.max_payload() != plain_max - LORAL2_ADDR_LEN) {
+		printf("Addressing: max payload not reduced\n");
+		exit(1);
+	}
+
+	uint8_t payload[256];
+	memset(payload, 0x5a, sizeof(payload));
+	addr_xfer(radio, &a, &b, 2, payload, 40);
+	addr_xfer(radio, &a, &c, 2, payload, 40);
+	if (obs_b.count != 1 || obs_b.err || obs_b.len != 40 || obs_b.src != 1 ||
+			obs_b.dst != 2) {
+		printf("Addressing: unicast not received\n");
+		exit(1);
+	}
+	if (obs_c.count || c.addr_discards() != 1 || b.addr_discards()) {
+		printf("Addressing: frame for another node not discarded\n");
+		exit(1);
+	}
+
+	// broadcast, and the largest payload
+	a.send(payload, 10);
+	a.on_sent();
+	c.on_recv(-50, radio.last_sent, radio.last_sent_len);
+	radio.last_sent = 0;
+	addr_xfer(radio, &a, &b, LORAL2_BROADCAST, payload, a.max_payload());
+	if (obs_c.count != 1 || obs_c.dst != LORAL2_BROADCAST || obs_c.src != 1 ||
+			obs_b.count != 2 || obs_b.err || obs_b.len != a.max_payload()) {
+		printf("Addressing: broadcast not received\n");
+		exit(1);
+	}
+	if (a.send_to(2, payload, a.max_payload() + 1)) {
+		printf("Addressing: oversized payload accepted\n");
+		exit(1);
+	}
+
+	// frame too short to carry the header
+	AddrObserver obs_d;
+	LoRaL2 plain(&radio, BAND, SPREAD, BWIDTH, 0, 0, &obs_a);
+	LoRaL2 d(&radio, BAND, SPREAD, BWIDTH, 0, 0, &obs_d);
+	d.set_address(4);
+	plain.send(payload, 2);
+	plain.on_sent();
+	d.on_recv(-50, radio.last_sent, radio.last_sent_len);
+	radio.last_sent = 0;
+	if (obs_d.count != 1 || obs_d.err != ADDR_ERR_SHORT) {
+		printf("Addressing: short frame not reported\n");
+		exit(1);
+	}
+
+	// unencrypted unicast
+	AddrObserver obs_e;
+	LoRaL2 e(&radio, BAND, SPREAD, BWIDTH, 0, 0, &obs_e);
+	e.set_address(5);
+	addr_xfer(radio, &d, &e, 5, payload, 40);
+	if (obs_e.count != 1 || obs_e.err || obs_e.len != 40 || obs_e.src != 4 ||
+			obs_e.dst != 5) {
+		printf("Addressing: unencrypted unicast not received\n");
+		exit(1);
+	}
+}
+
+// Receiver that keeps packets in handles
+class SpanReceiver: public LoRaL2Receiver
+{
+public:
+	SpanReceiver(): count(0), kept(0) {}
+	virtual void recv(const uint8_t *data, size_t len, const LoRaL2Meta &meta)
+	{
+		++count;
+		if (meta.err || len != test_len || memcmp(data, test_payload, len)) {
+			printf("Receiver: bad packet len %lu err %d\n", (unsigned long) len, meta.err);
+			exit(1);
+		}
+		LoRaL2Handle h = LoRaL2Handle::copy(data, len, meta);
+		if (h) {
+			handles[kept++] = std::move(h);
+		}
+	}
+	int count;
+	size_t kept;
+	LoRaL2Handle handles[LORAL2_HANDLE_SLOTS];
+};
+
+// Borrowed-buffer receive callback, pool of packet handles, and the
+// LoRaL2Observer adapter
+static void test_receiver()
+{
+	RadioEmu radio;
+	LoRaL2* l2 = keyed_l2(radio);
+	SpanReceiver rx;
+	l2->set_receiver(&rx);
+	loopback_frame(l2, 70);
+
+	// direct, then deferred, then worker; one more packet than handles
+	const int frames = LORAL2_HANDLE_SLOTS + 1;
+	for (int n = 0; n < frames; ++n) {
+		if (n == 2) {
+			l2->set_deferred_rx(true);
+		} else if (n == 3 && !l2->start_worker()) {
+			printf("Receiver: could not start worker\n");
+			exit(1);
+		}
+		if (n < 2) {
+			l2->on_recv(-50, memdup(radio.last_sent, radio.last_sent_len),
+					radio.last_sent_len);
+		} else {
+			inject_deferred(l2, radio, 1);
+		}
+		uint32_t timeout = arduino_millis() + 5000;
+		while (rx.count <= n && arduino_millis() < timeout) {
+			l2->poll();
+		}
+	}
+	l2->stop_worker();
+	if (rx.count != frames || test_recv_count != 0) {
+		printf("Receiver: received %d, observer %d\n", rx.count, test_recv_count);
+		exit(1);
+	}
+
+	// the pool is exhausted, handles outlive the callback
+	if (rx.kept != LORAL2_HANDLE_SLOTS || LoRaL2Handle::available() != 0) {
+		printf("Receiver: kept %lu handles\n", (unsigned long) rx.kept);
+		exit(1);
+	}
+	LoRaL2Handle moved = std::move(rx.handles[0]);
+	if (rx.handles[0] || !moved || moved.len() != test_len ||
+			memcmp(moved.data(), test_payload, test_len) || moved.meta().rssi != -50) {
+		printf("Receiver: bad handle\n");
+		exit(1);
+	}
+	moved = std::move(rx.handles[1]);
+	if (LoRaL2Handle::available() != 1) {
+		printf("Receiver: slot not released on move assignment\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < LORAL2_HANDLE_SLOTS; ++i) {
+		rx.handles[i].reset();
+	}
+	moved.reset();
+	if (LoRaL2Handle::available() != LORAL2_HANDLE_SLOTS) {
+		printf("Receiver: slots not released\n");
+		exit(1);
+	}
+
+	// back to the observer
+	l2->set_receiver(0);
+	inject_deferred(l2, radio, 1);
+	l2->poll();
+	if (test_recv_count != 1 || rx.count != frames) {
+		printf("Receiver: observer not restored\n");
+		exit(1);
+	}
+
+	free(test_payload);
+	delete l2;
+}
+
+class TxObserver: public LoRaL2SendObserver
+{
+public:
+	TxObserver(): count(0) {}
+	virtual void sent(const LoRaL2TxReport &r)
+	{
+		++count;
+		last = r;
+	}
+	int count;
+	LoRaL2TxReport last;
+};
+
+static void tx_check(TxObserver &obs, int count, uint32_t id, uint32_t duration_us, int status)
+{
+	const LoRaL2TxReport &r = obs.last;
+	if (obs.count != count || r.id != id || r.status != status ||
+			r.start_us < r.enqueue_us || r.end_us - r.start_us != duration_us) {
+		printf("Send reports: got %d, id %lu status %d, %lu/%lu/%lu us\n",
+			obs.count, (unsigned long) r.id, r.status,
+			(unsigned long) r.enqueue_us, (unsigned long) r.start_us,
+			(unsigned long) r.end_us);
+		exit(1);
+	}
+}
+
+// Send completion reports, with virtual time
+static void test_send_reports()
+{
+	ArduinoVirtualClock clock(1000000);
+	arduino_set_clock(&clock);
+
+	RadioEmu radio;
+	LoRaL2* l2 = keyed_l2(radio);
+	TxObserver obs;
+	l2->set_send_observer(&obs);
+	uint8_t payload[50];
+	memset(payload, 0x42, sizeof(payload));
+
+	// reported right away by on_sent()
+	l2->send(payload, sizeof(payload));
+	uint32_t id = l2->tx_id();
+	clock.advance(l2->airtime_us(sizeof(payload)));
+	l2->on_sent();
+	tx_check(obs, 1, id, l2->airtime_us(sizeof(payload)), TX_OK);
+	// spurious completion
+	l2->on_sent();
+	tx_check(obs, 1, id, l2->airtime_us(sizeof(payload)), TX_OK);
+
+	// deferred: reported by poll()
+	l2->set_deferred_rx(true);
+	l2->send(payload, sizeof(payload));
+	clock.advance(5000);
+	l2->on_sent();
+	if (obs.count != 1) {
+		printf("Send reports: deferred report before poll()\n");
+		exit(1);
+	}
+	l2->poll();
+	tx_check(obs, 2, id + 1, 5000, TX_OK);
+
+	// radio never reports the end of transmission
+	l2->set_send_observer(&obs, 100);
+	l2->send(payload, sizeof(payload));
+	clock.advance(50000);
+	l2->poll();
+	if (obs.count != 2) {
+		printf("Send reports: early timeout\n");
+		exit(1);
+	}
+	clock.advance(50000);
+	l2->poll();
+	tx_check(obs, 3, id + 2, 100000, TX_ERR_TIMEOUT);
+	if (!l2->send(payload, sizeof(payload))) {
+		printf("Send reports: radio still busy after timeout\n");
+		exit(1);
+	}
+	// the timed-out frame completes late, while the next one is on air
+	clock.advance(1000);
+	l2->on_sent();
+	l2->poll();
+	if (obs.count != 3 || l2->send(payload, sizeof(payload))) {
+		printf("Send reports: late completion taken for the next frame\n");
+		exit(1);
+	}
+	clock.advance(l2->airtime_us(sizeof(payload)) - 1000);
+	l2->on_sent();
+	l2->poll();
+	tx_check(obs, 4, id + 3, l2->airtime_us(sizeof(payload)), TX_OK);
+
+	// no late completion: the next one is the frame's own
+	l2->send(payload, sizeof(payload));
+	clock.advance(100000);
+	l2->poll();
+	tx_check(obs, 5, id + 4, 100000, TX_ERR_TIMEOUT);
+	l2->send(payload, sizeof(payload));
+	clock.advance(l2->airtime_us(sizeof(payload)));
+	l2->on_sent();
+	l2->poll();
+	tx_check(obs, 6, id + 5, l2->airtime_us(sizeof(payload)), TX_OK);
+
+	delete l2;
+	arduino_set_clock(0);
+}
+
+class MetaReceiver: public LoRaL2Receiver, public LoRaL2Observer
+{
+public:
+	MetaReceiver(): count(0) {}
+	virtual void recv(const uint8_t *data, size_t len, const LoRaL2Meta &m)
+	{
+		++count;
+		meta = m;
+	}
+	virtual void recv(LoRaL2Packet *pkt)
+	{
+		++count;
+		meta.rssi = pkt->rssi;
+		meta.snr = pkt->snr;
+		meta.freq_error = pkt->freq_error;
+		meta.time_us = pkt->time_us;
+		meta.err = pkt->err;
+		delete pkt;
+	}
+	int count;
+	LoRaL2Meta meta;
+};
+
+static void rx_info_check(MetaReceiver &rx, int count, const LoRaL2RxInfo &info)
+{
+	if (rx.count != count || rx.meta.err || rx.meta.rssi != info.rssi ||
+			rx.meta.snr != info.snr || rx.meta.freq_error != info.freq_error ||
+			rx.meta.time_us != info.time_us) {
+		printf("RX info: got %d, rssi %d snr %g ferr %ld time %lu\n", rx.count,
+			rx.meta.rssi, rx.meta.snr, (long) rx.meta.freq_error,
+			(unsigned long) rx.meta.time_us);
+		exit(1);
+	}
+}
+
+// RX time, SNR and frequency error go from driver to application
+static void test_rx_info()
+{
+	ArduinoVirtualClock clock(5000000);
+	arduino_set_clock(&clock);
+
+	RadioEmu radio;
+	quiet_radio(radio);
+	MetaReceiver rx;
+	LoRaL2* l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
+			"abracadabra", strlen("abracadabra"), &rx);
+	uint8_t payload[20];
+	memset(payload, 0x11, sizeof(payload));
+	l2->send(payload, sizeof(payload));
+	l2->on_sent();
+	uint8_t *frame = radio.last_sent;
+	size_t len = radio.last_sent_len;
+
+	LoRaL2RxInfo info;
+	info.rssi = -87;
+	info.snr = 6.25;
+	info.freq_error = -1234;
+	info.time_us = arduino_micros();
+
+	// observer adapter
+	l2->on_recv(info, memdup(frame, len), len);
+	rx_info_check(rx, 1, info);
+
+	// deferred: the RX time is the capture time, not the processing time
+	l2->set_receiver(&rx);
+	l2->set_deferred_rx(true);
+	uint8_t *slot = l2->on_recv_slot();
+	memcpy(slot, frame, len);
+	l2->on_recv_commit(info, len);
+	clock.advance(30000);
+	l2->poll();
+	rx_info_check(rx, 2, info);
+
+	// drivers that only know the RSSI
+	slot = l2->on_recv_slot();
+	memcpy(slot, frame, len);
+	l2->on_recv_commit(-50, len);
+	LoRaL2RxInfo plain = {-50, 0, 0, arduino_micros()};
+	clock.advance(30000);
+	l2->poll();
+	rx_info_check(rx, 3, plain);
+
+	delete l2;
+	arduino_set_clock(0);
+}
+
+// Keys and fixed parts of a telemetry format, shared by all nodes
+static const char telemetry_dict[] =
+	"{\"dev\":\"meter-\",\"t\":,\"hum\":,\"bat\":3.,\"seq\":}";
+
+static size_t compress_check(const uint8_t *dict, size_t dict_len,
+		const uint8_t *data, size_t len, bool shrinks)
+{
+	uint8_t zipped[256];
+	uint8_t back[256];
+	size_t zipped_len = LoRaL2Compress::compress(dict, dict_len, data, len, zipped);
+	if (shrinks != (zipped_len > 0) || zipped_len >= len) {
+		printf("Compress: %lu octets to %lu\n", (unsigned long) len,
+			(unsigned long) zipped_len);
+		exit(1);
+	}
+	if (zipped_len) {
+		int n = LoRaL2Compress::decompress(dict, dict_len, zipped, zipped_len,
+				back, sizeof(back));
+		if (n != (int) len || memcmp(back, data, len)) {
+			printf("Compress: round trip failed, %d octets\n", n);
+			exit(1);
+		}
+	}
+	return zipped_len;
+}
+
+// LZ with static dictionary, and the compression stage of LoRaL2
+static void test_compress()
+{
+	const uint8_t *dict = (const uint8_t*) telemetry_dict;
+	size_t dict_len = strlen(telemetry_dict);
+	const char *json = "{\"dev\":\"meter-0042\",\"t\":21.5,\"hum\":63,"
+				"\"bat\":3.71,\"seq\":1234}";
+	size_t json_len = strlen(json);
+
+	uint8_t data[200];
+	for (size_t i = 0; i < sizeof(data); ++i) {
+		data[i] = random() % 256;
+	}
+	compress_check(0, 0, data, sizeof(data), false);
+	compress_check(dict, dict_len, data, 1, false);
+	memset(data, 'a', sizeof(data));
+	compress_check(0, 0, data, sizeof(data), true);
+	size_t plain = compress_check(0, 0, (const uint8_t*) json, json_len, false);
+	size_t with_dict = compress_check(dict, dict_len, (const uint8_t*) json, json_len, true);
+	printf("Compress: telemetry %lu octets, %lu with dictionary\n",
+		(unsigned long) json_len, (unsigned long) with_dict);
+	if (plain) {
+		printf("Compress: telemetry should not shrink without dictionary\n");
+		exit(1);
+	}
+
+	// truncated literals, distance out of the window, output too long
+	uint8_t bad1[] = {5, 'a'};
+	uint8_t bad2[] = {0x80, 0x10};
+	uint8_t bad3[] = {2, 'a', 'b', 'c', 0x80 | (31 << 2), 0x00};
+	if (LoRaL2Compress::decompress(0, 0, bad1, sizeof(bad1), data, sizeof(data)) >= 0 ||
+			LoRaL2Compress::decompress(0, 0, bad2, sizeof(bad2), data, sizeof(data)) >= 0 ||
+			LoRaL2Compress::decompress(0, 0, bad3, sizeof(bad3), data, 10) >= 0 ||
+			LoRaL2Compress::decompress(0, 0, bad3, sizeof(bad3), data, 37) != 37) {
+		printf("Compress: malformed data accepted\n");
+		exit(1);
+	}
+
+	RadioEmu radio;
+	quiet_radio(radio);
+	LoRaL2* l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
+			"abracadabra", strlen("abracadabra"), observer);
+	l2->set_compression(true, dict, dict_len);
+
+	// compressed on air; incompressible payloads go as they are
+	test_exp_err_min = test_exp_err_max = 0;
+	test_recv_count = 0;
+	for (int i = 0; i < 2; ++i) {
+		test_len = i ? 100 : json_len;
+		test_payload = (uint8_t*) malloc(test_len);
+		for (size_t j = 0; j < test_len; ++j) {
+			test_payload[j] = i ? random() % 256 : json[j];
+		}
+		l2->send(test_payload, test_len);
+		l2->on_sent();
+		size_t len = radio.last_sent_len;
+		if (i ? len != l2->frame_len(test_len) : len >= l2->frame_len(test_len)) {
+			printf("Compress: frame of %lu octets, worst case %lu\n",
+				(unsigned long) len, (unsigned long) l2->frame_len(test_len));
+			exit(1);
+		}
+		l2->on_recv(-50, memdup(radio.last_sent, len), len);
+		free(test_payload);
+		test_payload = 0;
+	}
+	if (test_recv_count != 2) {
+		printf("Compress: %d packets received\n", test_recv_count);
+		exit(1);
+	}
+
+	// receiver without the dictionary cannot make sense of the frame
+	l2->send((const uint8_t*) json, json_len);
+	l2->on_sent();
+	LoRaL2* l2b = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
+			"abracadabra", strlen("abracadabra"), observer);
+	l2b->set_compression(true);
+	test_exp_err_min = test_exp_err_max = COMPRESS_ERR_DATA;
+	l2b->on_recv(-50, memdup(radio.last_sent, radio.last_sent_len), radio.last_sent_len);
+	if (test_recv_count != 3) {
+		printf("Compress: bad frame not delivered\n");
+		exit(1);
+	}
+
+	delete l2b;
+	delete l2;
+}
+
+// Meter reading: temperature (0.01 C), humidity (%), battery (mV),
+// door switch, pulse count, pressure (0.1 hPa)
+static const LoRaL2Field meter_schema[] = {
+	{LORAL2_FIELD_VARINT, 0, true, 100},
+	{LORAL2_FIELD_BITS, 7, false, 1},
+	{LORAL2_FIELD_VARINT, 0, true, 1},
+	{LORAL2_FIELD_BITS, 1, false, 1},
+	{LORAL2_FIELD_VARINT, 0, true, 1},
+	{LORAL2_FIELD_VARINT, 0, true, 10},
+};
+#define METER_FIELDS (sizeof(meter_schema) / sizeof(meter_schema[0]))
+
+static void meter_reading(LoRaL2Reading &r, int i)
+{
+	r.stream = 1;
+	r.set(meter_schema, 0, 21.53 + 0.01 * (i % 7) - (i % 3) * 0.02);
+	r.values[1] = 63 + (i % 2);
+	r.values[2] = 3710 - i / 4;
+	r.values[3] = (i / 5) % 2;
+	r.values[4] = 120345 + 3 * i;
+	r.set(meter_schema, 5, 1013.2 + 0.1 * (i % 4));
+}
+
+static void reading_check(const LoRaL2Reading &a, const LoRaL2Reading &b, int err)
+{
+	if (err || a.stream != b.stream || a.seq != b.seq ||
+			memcmp(a.values, b.values, METER_FIELDS * sizeof(int32_t))) {
+		printf("Telemetry: reading mismatch, err %d seq %d/%d\n", err, a.seq, b.seq);
+		exit(1);
+	}
+}
+
+// Schema codec: full and delta readings, acks, packing several
+// readings in a short frame
+static void test_telemetry()
+{
+	LoRaL2TelemetryEncoder enc(meter_schema, METER_FIELDS);
+	LoRaL2TelemetryDecoder dec(meter_schema, METER_FIELDS);
+	LoRaL2Reading r, got;
+	uint8_t buf[64];
+	size_t used;
+
+	// full reading, as long as nothing is acked
+	meter_reading(r, 0);
+	size_t full_len = enc.encode(r, buf, sizeof(buf));
+	reading_check(r, got, dec.decode(buf, full_len, got, used));
+	if (used != full_len || full_len > enc.max_len() ||
+			fabs(got.get(meter_schema, 0) - 21.53) > 0.001) {
+		printf("Telemetry: full reading %lu octets, used %lu\n",
+			(unsigned long) full_len, (unsigned long) used);
+		exit(1);
+	}
+	if (!enc.ack(got.stream, got.seq)) {
+		printf("Telemetry: ack refused\n");
+		exit(1);
+	}
+
+	// deltas, packed back to back in a short-tier frame
+	size_t len = 0;
+	int packed = 0;
+	size_t n;
+	while (true) {
+		meter_reading(r, packed + 1);
+		n = enc.encode(r, buf + len, 50 - len);
+		if (!n) {
+			break;
+		}
+		len += n;
+		++packed;
+	}
+	size_t off = 0;
+	for (int i = 1; i <= packed; ++i) {
+		meter_reading(r, i);
+		r.seq = i;
+		reading_check(r, got, dec.decode(buf + off, len - off, got, used));
+		off += used;
+	}
+	char text[80];
+	meter_reading(r, 1);
+	int text_len = snprintf(text, sizeof(text), "T=%.2f H=%d B=%d D=%d P=%d Pr=%.1f",
+			r.get(meter_schema, 0), r.values[1], r.values[2], r.values[3],
+			r.values[4], r.get(meter_schema, 5));
+	printf("Telemetry: text %d octets, full %lu, delta %lu, %d readings in 50 octets\n",
+		text_len, (unsigned long) full_len, (unsigned long) (len / packed), packed);
+	if (off != len || packed < 5) {
+		printf("Telemetry: only %d deltas packed\n", packed);
+		exit(1);
+	}
+
+	// receiver restarted: deltas cannot be decoded, but can be skipped,
+	// and name the stream to nack; the sender resets it and recovers
+	LoRaL2TelemetryDecoder fresh(meter_schema, METER_FIELDS);
+	got.stream = got.seq = 0xff;
+	int err = fresh.decode(buf, len, got, used);
+	if (err != TELEMETRY_ERR_REF || used == 0 || used >= len ||
+			got.stream != r.stream || got.seq != 1) {
+		printf("Telemetry: delta without reference, err %d stream %d seq %d\n",
+			err, got.stream, got.seq);
+		exit(1);
+	}
+	enc.reset(got.stream);
+	meter_reading(r, 20);
+	n = enc.encode(r, buf, sizeof(buf));
+	reading_check(r, got, fresh.decode(buf, n, got, used));
+
+	// old readings cannot be acked; extremes; truncated data
+	if (enc.ack(1, r.seq - LORAL2_TELEMETRY_HISTORY) || enc.ack(7, 0)) {
+		printf("Telemetry: stale ack accepted\n");
+		exit(1);
+	}
+	r.values[0] = INT32_MIN;
+	r.values[1] = 127;
+	r.values[2] = INT32_MAX;
+	r.values[4] = -1;
+	n = enc.encode(r, buf, sizeof(buf));
+	reading_check(r, got, fresh.decode(buf, n, got, used));
+	if (fresh.decode(buf, n - 1, got, used) != TELEMETRY_ERR_DATA ||
+			enc.encode(r, buf, n - 1) != 0) {
+		printf("Telemetry: truncated reading accepted\n");
+		exit(1);
+	}
+}
+
+#ifdef LORAL2_TRACE
+static void trace_check(const LoRaL2TraceRecord &r, int event, int a, int32_t b)
+{
+	if (r.event != event || r.a != a || r.b != b) {
+		printf("Trace: expected %s %d %ld, got %s %d %ld\n",
+			loral2_trace_event_name(event), a, (long) b,
+			loral2_trace_event_name(r.event), r.a, (long) r.b);
+		exit(1);
+	}
+}
+
+// Pipeline events of one frame sent and received, dump and parse
+static void test_trace()
+{
+	ArduinoVirtualClock clock(1000000);
+	arduino_set_clock(&clock);
+	loral2_trace_clear();
+
+	RadioEmu radio;
+	quiet_radio(radio);
+	MetaReceiver rx;
+	LoRaL2* l2 = new LoRaL2(&radio, BAND, SPREAD, BWIDTH,
+			"abracadabra", strlen("abracadabra"), &rx);
+	uint8_t payload[20];
+	memset(payload, 0x22, sizeof(payload));
+	l2->send(payload, sizeof(payload));
+	clock.advance(50000);
+	l2->on_sent();
+	size_t len = radio.last_sent_len;
+	uint8_t *frame = memdup(radio.last_sent, len);
+	frame[3] ^= 0xff;
+	frame[10] ^= 0x01;
 
-	lora_emu_call_onsent = false;
-	lora_emu_sim_senderr = false;
+	LoRaL2RxInfo info = {-90, 5, 0, arduino_micros() - 1000};
+	l2->on_recv(info, frame, len);
+
+	uint8_t dump[LORAL2_TRACE_HDR_LEN + LORAL2_TRACE_SLOTS * LORAL2_TRACE_REC_LEN];
+	size_t dump_len = loral2_trace_dump(dump, sizeof(dump));
+	LoRaL2TraceRecord r[LORAL2_TRACE_SLOTS];
+	uint32_t total;
+	int n = loral2_trace_parse(dump, dump_len, r, LORAL2_TRACE_SLOTS, total);
+	if (n != 7 || total != 7) {
+		printf("Trace: %d records, %lu events\n", n, (unsigned long) total);
+		exit(1);
+	}
+	trace_check(r[0], LORAL2_EV_TX_ENQUEUE, 20, 0);
+	trace_check(r[1], LORAL2_EV_TX_START, len, 1);
+	trace_check(r[2], LORAL2_EV_TX_DONE, TX_OK, 1);
+	trace_check(r[3], LORAL2_EV_RX_ISR, len, -90);
+	trace_check(r[4], LORAL2_EV_FEC, 0, 2);
+	trace_check(r[5], LORAL2_EV_DECRYPT, 0, 20);
+	trace_check(r[6], LORAL2_EV_DISPATCH, 20, 0);
+	if (r[2].time_us - r[1].time_us != 50000 || r[3].time_us != info.time_us ||
+			r[0].unit != r[6].unit) {
+		printf("Trace: bad timestamps or units\n");
+		exit(1);
+	}
+
+	// oldest events are overwritten
+	for (int i = 0; i < LORAL2_TRACE_SLOTS + 5; ++i) {
+		LORAL2_TRACE_EVENT(0, LORAL2_EV_DUPLICATE, 0, i);
+	}
+	dump_len = loral2_trace_dump(dump, sizeof(dump));
+	n = loral2_trace_parse(dump, dump_len, r, LORAL2_TRACE_SLOTS, total);
+	if (n != LORAL2_TRACE_SLOTS || total != 7 + LORAL2_TRACE_SLOTS + 5) {
+		printf("Trace: wrap %d records, %lu events\n", n, (unsigned long) total);
+		exit(1);
+	}
+	trace_check(r[0], LORAL2_EV_DUPLICATE, 0, 5);
+
+	if (loral2_trace_dump(dump, LORAL2_TRACE_HDR_LEN) != 0 ||
+			loral2_trace_parse(dump, dump_len - 1, r, LORAL2_TRACE_SLOTS, total) != -1) {
+		printf("Trace: short buffers accepted\n");
+		exit(1);
+	}
+
+	loral2_trace_clear();
+	delete l2;
+	arduino_set_clock(0);
+}
+#endif
+
+// Worker thread does FEC and decryption, poll() only dispatches
+static void test_worker()
+{
+	RadioEmu radio;
+	LoRaL2* l2 = keyed_l2(radio);
+	if (!l2->start_worker()) {
+		printf("Worker: could not start\n");
+		exit(1);
+	}
+	loopback_frame(l2, 100);
+
+	const int frames = 3;
+	inject_deferred(l2, radio, frames);
+
+	uint32_t timeout = arduino_millis() + 5000;
+	while (test_recv_count < frames && arduino_millis() < timeout) {
+		l2->poll();
+	}
+	if (test_recv_count != frames) {
+		printf("Worker: received %d, expected %d\n", test_recv_count, frames);
+		exit(1);
+	}
+
+	l2->stop_worker();
+	if (l2->worker_running()) {
+		printf("Worker: still running after stop\n");
+		exit(1);
+	}
+
+	free(test_payload);
+	delete l2;
+}
+
+// Two radio + stack pairs in the same process
+static void test_multi()
+{
+	RadioEmu radio_a;
+	RadioEmu radio_b;
+	LoRaL2* a = keyed_l2(radio_a);
+	LoRaL2* b = keyed_l2(radio_b);
+	b->set_deferred_rx(true);
+
+	// A transmits, B receives
+	loopback_frame(a, 60);
+	if (!radio_a.last_sent || radio_b.last_sent) {
+		printf("Multi: frame sent by the wrong radio\n");
+		exit(1);
+	}
+	inject_deferred(b, radio_a, 1);
+	if (a->poll() != 0 || b->poll() != 1 || test_recv_count != 1) {
+		printf("Multi: frame not received by B\n");
+		exit(1);
+	}
+
+	// B transmits while A is busy transmitting
+	a->send(test_payload, test_len);
+	if (!b->send(test_payload, test_len)) {
+		printf("Multi: B blocked by A\n");
+		exit(1);
+	}
+	b->on_sent();
+	a->on_recv(-50, memdup(radio_b.last_sent, radio_b.last_sent_len),
+			radio_b.last_sent_len);
+	if (test_recv_count != 2) {
+		printf("Multi: frame not received by A\n");
+		exit(1);
+	}
+
+	free(test_payload);
+	delete a;
+	delete b;
+}
+
+// FEC codecs are shared, decoding must work from several threads at once.
+// With LORAL2_FEC_SHARED_WORKSPACE, threads that find the workspace busy
+// fall back to the stack.
+struct FecThreadArg {
+	LoRaL2 *l2;
+	int failures;
+};
+
+static void fec_thread(void *varg)
+{
+	FecThreadArg *arg = (FecThreadArg*) varg;
+	uint8_t payload[200];
+
+	for (int n = 0; n < 300; ++n) {
+		size_t len = 1 + n % sizeof(payload);
+		for (size_t i = 0; i < len; ++i) {
+			payload[i] = n + i;
+		}
+		size_t fec_len;
+		uint8_t *frame = arg->l2->append_fec(payload, len, fec_len);
+		// within correction capability of all codecs
+		for (int i = 0; i < 4; ++i) {
+			frame[(n * 7 + i * 13) % fec_len] ^= 0x5a;
+		}
+		size_t dec_len;
+		int err;
+		uint8_t *dec = arg->l2->decode_fec(frame, fec_len, dec_len, err);
+		if (err || dec_len != len || memcmp(dec, payload, len)) {
+			++arg->failures;
+		}
+		free(dec);
+		free(frame);
+	}
+}
+
+static void test_fec_threads()
+{
+	const int threads = 4;
+	RadioEmu radio[threads];
+	FecThreadArg args[threads];
+	void *tasks[threads];
+
+	for (int t = 0; t < threads; ++t) {
+		quiet_radio(radio[t]);
+		args[t].l2 = new LoRaL2(&radio[t], BAND, SPREAD, BWIDTH, 0, 0, 0);
+		args[t].failures = 0;
+		tasks[t] = arduino_task_start(fec_thread, &args[t], t);
+	}
+	for (int t = 0; t < threads; ++t) {
+		arduino_task_join(tasks[t]);
+		if (args[t].failures) {
+			printf("FEC threads: %d failures in thread %d\n", args[t].failures, t);
+			exit(1);
+		}
+		delete args[t].l2;
+	}
+}
+
+// Encodes and decodes every payload length through a ladder
+template <typename Ladder>
+static void fec_ladder_matrix(const char *name)
+{
+	uint8_t padded[Ladder::max_k];
+	uint8_t msg[Ladder::max_k];
+	uint8_t orig[Ladder::max_k];
+	uint8_t frame[Ladder::max_n];
+	size_t net_len;
+	// odd lengths use a shared scratch, even lengths the stack
+	static typename Ladder::Scratch scratch;
+
+	printf("FEC ladder %s, %lu tiers, %lu octets of RS scratch\n", name,
+		(unsigned long) Ladder::tiers, (unsigned long) sizeof(scratch));
+
+	for (size_t len = 0; len <= Ladder::max_k; ++len) {
+		memset(padded, 0, sizeof(padded));
+		for (size_t i = 0; i < len; ++i) {
+			padded[i] = frame[i] = orig[i] = random() % 256;
+		}
+		typename Ladder::Scratch *s = (len & 1) ? &scratch : 0;
+		size_t parity = Ladder::encode(padded, len, frame + len, s);
+		size_t frame_len = len + parity;
+		if (parity != Ladder::parity_len(len) || Ladder::tier(frame_len) < 0) {
+			printf("\tlen %lu: bad parity %lu or tier\n", len, parity);
+			exit(1);
+		}
+
+		// correctable errors
+		for (size_t i = 0; i < parity / 2; ++i) {
+			frame[random() % frame_len] ^= 1 + random() % 255;
+		}
+		memset(padded, 0, sizeof(padded));
+		int err = Ladder::decode(frame, frame_len, padded, msg, net_len, s);
+		if (err || net_len != len || memcmp(msg, orig, len)) {
+			printf("\tlen %lu: err %d net_len %lu\n", len, err, net_len);
+			exit(1);
+		}
+	}
+
+	// lengths no sender can produce
+	for (size_t frame_len = 0; frame_len <= 255; ++frame_len) {
+		bool valid = false;
+		for (size_t len = 0; len <= Ladder::max_k; ++len) {
+			valid = valid || (len + Ladder::parity_len(len) == frame_len);
+		}
+		if (valid != (Ladder::tier(frame_len) >= 0)) {
+			printf("\tframe len %lu: tier %d\n", frame_len, Ladder::tier(frame_len));
+			exit(1);
+		}
+		if (!valid) {
+			memset(padded, 0, sizeof(padded));
+			memset(frame, 0, sizeof(frame));
+			int err = Ladder::decode(frame, frame_len, padded, msg, net_len);
+			if (err != FEC_ERR_LENGTH || net_len != 0) {
+				printf("\tframe len %lu: err %d\n", frame_len, err);
+				exit(1);
+			}
+		}
+	}
+}
+
+// GF tables and generators are built at compile time; check them, and
+// that parity is the same as with the former hand-written tables
+static_assert(RS::gf::field::tables.exp[8] == 0x1d, "GF(2^8) tables");
+static_assert(RS::ReedSolomon<50, 10>::generator.coef[0] == 1, "generator");
+
+template <uint8_t ecc_length>
+static void check_generator()
+{
+	const uint8_t *g = RS::ReedSolomon<1, ecc_length>::generator.coef;
+	for (int i = 0; i < ecc_length; ++i) {
+		// 2^i must be a root
+		uint8_t y = 0;
+		for (int j = 0; j <= ecc_length; ++j) {
+			y = RS::gf::mul(y, RS::gf::pow(2, i)) ^ g[j];
+		}
+		if (y) {
+			printf("RS generator %d: 2^%d is not a root\n", ecc_length, i);
+			exit(1);
+		}
+	}
+}
+
+static void test_rs_tables()
+{
+	for (int x = 1; x < 256; ++x) {
+		if (RS::gf::exp(RS::gf::log(x)) != x || RS::gf::exp(RS::gf::log(x) + 255) != x) {
+			printf("GF tables: bad log/exp of %d\n", x);
+			exit(1);
+		}
+	}
+	check_generator<10>();
+	check_generator<14>();
+	check_generator<20>();
+	check_generator<32>();
+
+	uint8_t msg[230];
+	for (int i = 0; i < 230; ++i) {
+		msg[i] = i * 7 + 3;
+	}
+	static const uint8_t kat10[] = {209, 147, 116, 163, 143, 91, 205, 68, 178, 179};
+	static const uint8_t kat14[] = {44, 72, 144, 213, 211, 73, 131, 192, 32, 133,
+					210, 152, 83, 68};
+	static const uint8_t kat20[] = {176, 21, 119, 85, 21, 19, 252, 141, 240, 194,
+					117, 202, 111, 238, 199, 112, 17, 84, 185, 206};
+	uint8_t parity[20];
+	FecCode<50, 10>::codec.EncodeBlock(msg, parity);
+	bool ok = !memcmp(parity, kat10, sizeof(kat10));
+	FecCode<100, 14>::codec.EncodeBlock(msg, parity);
+	ok = ok && !memcmp(parity, kat14, sizeof(kat14));
+	FecCode<230, 20>::codec.EncodeBlock(msg, parity);
+	ok = ok && !memcmp(parity, kat20, sizeof(kat20));
+	if (!ok) {
+		printf("RS parity known-answer test failed\n");
+		exit(1);
+	}
+}
+
+static void test_fec_ladder()
+{
+	fec_ladder_matrix<LoRaL2Fec>("LoRaL2");
+	fec_ladder_matrix<FecLadder<FecCode<32, 8>, FecCode<64, 12>, FecCode<128, 16>,
+		FecCode<230, 20>>>("fine");
+	fec_ladder_matrix<FecLadder<FecCode<200, 24>>>("single");
+	fec_ladder_matrix<FecLadder<FecCode<16, 4>, FecCode<17, 4>, FecCode<250, 4>>>("tight");
+}
+
+class SimCounter: public LoRaL2Observer
+{
+public:
+	SimCounter(): ok(0), bad(0) {}
+	virtual void recv(LoRaL2Packet *pkt)
+	{
+		if (pkt->err) {
+			++bad;
+		} else {
+			++ok;
+		}
+		delete pkt;
+	}
+	int ok;
+	int bad;
+};
+
+static void sim_send(LoRaL2 *l2, size_t len)
+{
+	uint8_t payload[256];
+	memset(payload, (int) len, len);
+	l2->send(payload, len);
+}
+
+// Runs a random network for half an hour of virtual time
+static void sim_network(ChannelSim &sim, SimCounter &counter, int nodes)
+{
+	std::vector<LoRaL2*> l2(nodes);
+
+	sim.set_error_model(SIM_ERR_BURST);
+	for (int i = 0; i < nodes; ++i) {
+		int id = sim.add_node();
+		l2[i] = new LoRaL2(sim.radio(id), BAND, SPREAD, BWIDTH, 0, 0, &counter);
+	}
+	for (int i = 0; i < nodes; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			sim.link(i, sim.random() % nodes, -10.0 + sim.uniform() * 25.0);
+		}
+	}
+	const uint64_t duration = 30ULL * 60 * 1000000;
+	for (int i = 0; i < nodes; ++i) {
+		for (uint64_t t = sim.random() % 600000000; t < duration;
+					t += 600000000 + sim.random() % 600000000) {
+			LoRaL2 *n = l2[i];
+			size_t len = 1 + sim.random() % n->max_payload();
+			sim.at(t, [n, len] { sim_send(n, len); });
+		}
+	}
+	sim.run_until(duration);
+
+	for (int i = 0; i < nodes; ++i) {
+		delete l2[i];
+	}
+}
+
+static void test_channel_sim()
+{
+	// SF7, 125kHz, CR 4/5, 20 octets: 50.25 symbols of 1.024ms
+	if (LoRaL2::frame_airtime_us(7, 125000, 5, 20) != 51456) {
+		printf("Sim: bad airtime %lu\n",
+			(unsigned long) LoRaL2::frame_airtime_us(7, 125000, 5, 20));
+		exit(1);
+	}
+
+	{
+		// A -> B, and A and C colliding at B
+		ChannelSim sim(1);
+		SimCounter counter;
+		sim.set_error_model(SIM_ERR_NONE);
+		int a = sim.add_node();
+		int b = sim.add_node();
+		int c = sim.add_node();
+		LoRaL2 *la = new LoRaL2(sim.radio(a), BAND, SPREAD, BWIDTH, 0, 0, &counter);
+		LoRaL2 *lb = new LoRaL2(sim.radio(b), BAND, SPREAD, BWIDTH, 0, 0, &counter);
+		LoRaL2 *lc = new LoRaL2(sim.radio(c), BAND, SPREAD, BWIDTH, 0, 0, &counter);
+		sim.link(a, b, 5.0);
+		sim.link(c, b, 5.0);
+
+		// simulated time is seen by arduino_millis() and friends
+		arduino_set_clock(&sim);
+		uint32_t sent_at = 0;
+		sim.at(1000, [la, &sent_at] { sim_send(la, 20); sent_at = arduino_micros(); });
+		sim.run_until(1000000);
+		arduino_set_clock(0);
+		if (counter.ok != 1 || sim.tx_frames != 1 || sent_at != 1000) {
+			printf("Sim: A -> B failed\n");
+			exit(1);
+		}
+
+		// same power, both lost
+		sim.at(2000000, [la] { sim_send(la, 20); });
+		sim.at(2010000, [lc] { sim_send(lc, 20); });
+		sim.run_until(3000000);
+		if (counter.ok != 1 || sim.collisions != 2) {
+			printf("Sim: collision not detected\n");
+			exit(1);
+		}
+
+		// C is 10dB stronger and captures the receiver
+		sim.link(c, b, 15.0);
+		sim.at(4000000, [la] { sim_send(la, 20); });
+		sim.at(4010000, [lc] { sim_send(lc, 20); });
+		sim.run_until(5000000);
+		if (counter.ok != 2 || sim.captures != 1) {
+			printf("Sim: capture effect not simulated\n");
+			exit(1);
+		}
+
+		delete la;
+		delete lb;
+		delete lc;
+	}
+
+	// large network, must be deterministic
+	ChannelSim sim1(42), sim2(42);
+	SimCounter counter1, counter2;
+	sim_network(sim1, counter1, 200);
+	sim_network(sim2, counter2, 200);
+	printf("Sim: %u frames sent, %u received (%u corrupted), "
+		"%u collisions, %u captures, %u half-duplex, %u undetected; "
+		"%d decoded, %d failed\n",
+		sim1.tx_frames, sim1.rx_frames, sim1.rx_corrupted,
+		sim1.collisions, sim1.captures, sim1.half_duplex, sim1.undetected,
+		counter1.ok, counter1.bad);
+	if (sim1.tx_frames == 0 || counter1.ok == 0 || sim1.collisions == 0) {
+		printf("Sim: implausible network statistics\n");
+		exit(1);
+	}
+	if (sim1.rx_frames != sim2.rx_frames || sim1.collisions != sim2.collisions
+			|| counter1.ok != counter2.ok || counter1.bad != counter2.bad) {
+		printf("Sim: not deterministic\n");
+		exit(1);
+	}
+}
+
+// Many emulated nodes in a single process, over the multicast socket
+static void test_emu_net()
+{
+	const int nodes = 100;
+	EmuNet net;
+	if (!net.open()) {
+		printf("EmuNet: could not open socket\n");
+		exit(1);
+	}
+
+	SimCounter counter;
+	std::vector<RadioEmu*> radios(nodes);
+	std::vector<LoRaL2*> l2(nodes);
+	for (int i = 0; i < nodes; ++i) {
+		radios[i] = new RadioEmu(&net, i);
+		radios[i]->sim_senderr = false;
+		radios[i]->set_coverage(1);
+		l2[i] = new LoRaL2(radios[i], BAND, SPREAD, BWIDTH,
+				"abracadabra", strlen("abracadabra"), &counter);
+	}
+
+	uint8_t payload[50];
+	memset(payload, 0x55, sizeof(payload));
+	l2[0]->send(payload, sizeof(payload));
+
+	uint32_t timeout = arduino_millis() + 5000;
+	while (counter.ok < nodes - 1 && arduino_millis() < timeout) {
+		net.poll(10);
+	}
+	if (counter.ok != nodes - 1 || counter.bad) {
+		printf("EmuNet: %d nodes received, expected %d\n", counter.ok, nodes - 1);
+		exit(1);
+	}
+
+	// with a topology, node 0 only reaches its linked peers
+	const char *topo = "/tmp/loral2_test_topology.txt";
+	FILE *f = fopen(topo, "w");
+	fprintf(f, "# from to loss corrupt rssi\n"
+		"link 0 1 0 3 -90\n"
+		"link 0 2 1.0 0  # always lost\n"
+		"node 3 0x02\n");
+	fclose(f);
+	if (!net.load_topology(topo)) {
+		printf("EmuNet: bad topology\n");
+		exit(1);
+	}
+	remove(topo);
+
+	counter.ok = 0;
+	l2[0]->send(payload, sizeof(payload));
+	timeout = arduino_millis() + 1000;
+	while (arduino_millis() < timeout) {
+		net.poll(10);
+	}
+	if (counter.ok != 1 || counter.bad) {
+		printf("EmuNet: topology not honored, %d received\n", counter.ok);
+		exit(1);
+	}
+
+	// longer than a LoRa frame: not queued, and dropped on reception
+	uint8_t big[3 + 256];
+	memset(big, 0x55, sizeof(big));
+	RadioFrag frag = {big, 256};
+	big[0] = 0xff;
+	big[1] = 0;
+	big[2] = 1;
+	counter.ok = 0;
+	net.dispatch(big, sizeof(big));
+	if (net.queue(radios[0], &frag, 1) || counter.ok || counter.bad) {
+		printf("EmuNet: oversize frame not rejected\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < nodes; ++i) {
+		delete l2[i];
+		delete radios[i];
+	}
+}
+
+class MeshCounter: public LoRaL2Observer
+{
+public:
+	MeshCounter(): ok(0), bad(0) {}
+	virtual void recv(LoRaL2Packet *pkt)
+	{
+		if (pkt->err || pkt->len != 40 || pkt->packet[0] != 0x77 || pkt->packet[39] != 0x77) {
+			++bad;
+		} else {
+			++ok;
+		}
+		delete pkt;
+	}
+	int ok;
+	int bad;
+};
+
+// Runs the mesh nodes until node 'until' receives, or timeout
+static void mesh_run(EmuNet &net, std::vector<LoRaL2Mesh*> &mesh,
+		std::vector<MeshCounter> &counters, int until, uint32_t timeout_ms)
+{
+	uint32_t timeout = arduino_millis() + timeout_ms;
+	while (arduino_millis() < timeout && (until < 0 || !counters[until].ok)) {
+		net.poll(1);
+		for (size_t i = 0; i < mesh.size(); ++i) {
+			mesh[i]->poll();
+		}
+	}
+}
+
+static void mesh_net(EmuNet &net, const int *coverage, int nodes,
+		std::vector<RadioEmu*> &radios, std::vector<LoRaL2Mesh*> &mesh,
+		std::vector<MeshCounter> &counters)
+{
+	radios.resize(nodes);
+	mesh.resize(nodes);
+	counters.resize(nodes);
+	for (int i = 0; i < nodes; ++i) {
+		radios[i] = new RadioEmu(&net, 200 + i);
+		radios[i]->sim_senderr = false;
+		radios[i]->set_coverage(coverage[i]);
+		mesh[i] = new LoRaL2Mesh(radios[i], BAND, SPREAD, BWIDTH,
+				"abracadabra", strlen("abracadabra"), &counters[i]);
+	}
+}
+
+static void mesh_free(std::vector<RadioEmu*> &radios, std::vector<LoRaL2Mesh*> &mesh)
+{
+	for (size_t i = 0; i < mesh.size(); ++i) {
+		delete mesh[i];
+		delete radios[i];
+	}
+}
+
+static void test_mesh()
+{
+	// SF12 125kHz, CR 4/5, 20 octets: low data rate optimization,
+	// 40.25 symbols of 32.768ms
+	if (LoRaL2::frame_airtime_us(12, 125000, 5, 20) != 1318912) {
+		printf("Mesh: bad airtime %lu\n",
+			(unsigned long) LoRaL2::frame_airtime_us(12, 125000, 5, 20));
+		exit(1);
+	}
+
+	EmuNet net;
+	if (!net.open()) {
+		printf("Mesh: could not open socket\n");
+		exit(1);
+	}
+	uint8_t payload[40];
+	memset(payload, 0x77, sizeof(payload));
+
+	// line: 0 <-> 1 <-> 2 <-> 3, the far end is reached by relays
+	static const int line[] = {0x1, 0x3, 0x6, 0x4};
+	std::vector<RadioEmu*> radios;
+	std::vector<LoRaL2Mesh*> mesh;
+	std::vector<MeshCounter> counters;
+	mesh_net(net, line, 4, radios, mesh, counters);
+	if (!mesh[0]->send(payload, sizeof(payload))) {
+		printf("Mesh: send failed\n");
+		exit(1);
+	}
+	mesh_run(net, mesh, counters, 3, 10000);
+	// let the last relays die out
+	mesh_run(net, mesh, counters, -1, 1500);
+	for (int i = 0; i < 4; ++i) {
+		if (counters[i].ok != (i ? 1 : 0) || counters[i].bad) {
+			printf("Mesh: line node %d received %d\n", i, counters[i].ok);
+			exit(1);
+		}
+	}
+	if (!mesh[1]->relayed() || !mesh[2]->relayed() || !mesh[0]->duplicates()) {
+		printf("Mesh: line not relayed\n");
+		exit(1);
+	}
+	if (mesh[0]->send(payload, mesh[0]->max_payload() + 1)) {
+		printf("Mesh: oversized payload accepted\n");
+		exit(1);
+	}
+	mesh_free(radios, mesh);
+
+	// cluster: everybody hears everybody, most relays are cancelled
+	static const int cluster[] = {0x1, 0x1, 0x1, 0x1, 0x1};
+	counters.clear();
+	mesh_net(net, cluster, 5, radios, mesh, counters);
+	mesh[0]->send(payload, sizeof(payload));
+	mesh_run(net, mesh, counters, -1, 3000);
+	uint32_t relayed = 0, cancelled = 0;
+	for (int i = 1; i < 5; ++i) {
+		if (counters[i].ok != 1 || counters[i].bad) {
+			printf("Mesh: cluster node %d received %d\n", i, counters[i].ok);
+			exit(1);
+		}
+		relayed += mesh[i]->relayed();
+		cancelled += mesh[i]->relays_cancelled();
+	}
+	if (relayed + cancelled != 4 || !cancelled) {
+		printf("Mesh: cluster relayed %lu cancelled %lu\n",
+			(unsigned long) relayed, (unsigned long) cancelled);
+		exit(1);
+	}
+	mesh_free(radios, mesh);
+
+	// no airtime budget: nothing is relayed
+	counters.clear();
+	mesh_net(net, line, 4, radios, mesh, counters);
+	for (int i = 0; i < 4; ++i) {
+		mesh[i]->set_airtime_cap(0);
+	}
+	mesh[0]->send(payload, sizeof(payload));
+	mesh_run(net, mesh, counters, -1, 2000);
+	if (counters[1].ok != 1 || counters[2].ok || counters[3].ok ||
+			mesh[1]->relayed() || !mesh[1]->relays_dropped()) {
+		printf("Mesh: airtime cap not honored\n");
+		exit(1);
+	}
+	mesh_free(radios, mesh);
+}
+
+class RouterCounter: public LoRaL2RouterObserver
+{
+public:
+	RouterCounter(): ok(0), bad(0), last_src(LORAL2_ROUTE_NONE) {}
+	virtual void recv(uint16_t src, LoRaL2Packet *pkt)
+	{
+		if (pkt->err || pkt->len != 30 || pkt->packet[0] != 0x33 || pkt->packet[29] != 0x33) {
+			++bad;
+		} else {
+			++ok;
+		}
+		last_src = src;
+		delete pkt;
+	}
+	int ok;
+	int bad;
+	uint16_t last_src;
+};
+
+static void router_run(EmuNet &net, std::vector<LoRaL2Router*> &routers, uint32_t ms)
+{
+	uint32_t timeout = arduino_millis() + ms;
+	while (arduino_millis() < timeout) {
+		net.poll(1);
+		for (size_t i = 0; i < routers.size(); ++i) {
+			routers[i]->poll();
+		}
+	}
+}
+
+// Line of nodes, converges and routes unicast end to end
+static void test_router()
+{
+	const int nodes = 5;
+	const uint32_t beacon_ms = 200;
+	EmuNet net;
+	if (!net.open()) {
+		printf("Router: could not open socket\n");
+		exit(1);
+	}
+
+	std::vector<RadioEmu*> radios(nodes);
+	std::vector<LoRaL2Router*> routers(nodes);
+	std::vector<RouterCounter> counters(nodes);
+	for (int i = 0; i < nodes; ++i) {
+		radios[i] = new RadioEmu(&net, 300 + i);
+		radios[i]->sim_senderr = false;
+		// each node only hears its neighbours
+		radios[i]->set_coverage(i == 0 ? 1 : i == nodes - 1 ? 1 << (i - 1) : 3 << (i - 1));
+		routers[i] = new LoRaL2Router(radios[i], BAND, SPREAD, BWIDTH,
+				"abracadabra", strlen("abracadabra"), 10 + i, &counters[i]);
+		routers[i]->set_beacon_interval(beacon_ms);
+	}
+
+	uint8_t payload[30];
+	memset(payload, 0x33, sizeof(payload));
+	if (routers[0]->send(10 + nodes - 1, payload, sizeof(payload)) || !routers[0]->no_route()) {
+		printf("Router: sent without a route\n");
+		exit(1);
+	}
+
+	// convergence: every node has a route to every other node
+	uint32_t start = arduino_millis();
+	uint32_t converged = 0;
+	while (!converged && arduino_millis() - start < 20 * beacon_ms) {
+		router_run(net, routers, 10);
+		converged = arduino_millis() - start;
+		for (int i = 0; i < nodes; ++i) {
+			if (routers[i]->routes() != (size_t) nodes - 1) {
+				converged = 0;
+			}
+		}
+	}
+	uint32_t beacons = 0, octets = 0;
+	for (int i = 0; i < nodes; ++i) {
+		beacons += routers[i]->beacons();
+		octets += routers[i]->beacon_octets();
+	}
+	printf("Router: %d-node line converged in %lu ms (beacon %lu ms), "
+		"%lu beacons, %lu octets on air\n", nodes,
+		(unsigned long) converged, (unsigned long) beacon_ms,
+		(unsigned long) beacons, (unsigned long) octets);
+
+	uint16_t next;
+	int metric;
+	if (!converged || !routers[0]->route(10 + nodes - 1, next, metric) ||
+			next != 11 || metric != nodes - 1) {
+		printf("Router: did not converge\n");
+		exit(1);
+	}
+
+	if (!routers[0]->send(10 + nodes - 1, payload, sizeof(payload))) {
+		printf("Router: send failed\n");
+		exit(1);
+	}
+	router_run(net, routers, 500);
+	for (int i = 0; i < nodes; ++i) {
+		int expected = i == nodes - 1 ? 1 : 0;
+		if (counters[i].ok != expected || counters[i].bad) {
+			printf("Router: node %d received %d\n", i, counters[i].ok);
+			exit(1);
+		}
+		if ((i > 0 && i < nodes - 1) != (routers[i]->forwarded() == 1)) {
+			printf("Router: node %d forwarded %lu\n", i,
+				(unsigned long) routers[i]->forwarded());
+			exit(1);
+		}
+	}
+	if (counters[nodes - 1].last_src != 10) {
+		printf("Router: bad source\n");
+		exit(1);
+	}
+
+	// routes through a dead node expire, one hop after the other
+	delete routers[2];
+	delete radios[2];
+	routers.erase(routers.begin() + 2);
+	router_run(net, routers, 3 * LORAL2_ROUTE_MAX_AGE * beacon_ms);
+	if (routers[0]->route(10 + nodes - 1, next, metric) || routers[0]->routes() != 1) {
+		printf("Router: stale route kept\n");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < routers.size(); ++i) {
+		delete routers[i];
+	}
+	delete radios[0];
+	delete radios[1];
+	delete radios[3];
+	delete radios[4];
+}
+
+static void tdma_run(ChannelSim &sim, std::vector<LoRaL2Tdma*> &nodes, uint64_t until)
+{
+	for (uint64_t t = sim.now_us(); t < until; t += 1000) {
+		sim.run_until(t);
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			if (nodes[i]) nodes[i]->poll();
+		}
+	}
+}
+
+// Meters around a collector, one frame per meter and superframe:
+// scheduled access against pure ALOHA at the same offered load
+static void test_tdma()
+{
+	const int meters = 8;
+	const size_t len = 20;
+	const uint64_t duration = 60ULL * 1000000;
+	uint8_t payload[len];
+	memset(payload, 0x44, len);
+
+	ChannelSim sim(7);
+	sim.set_error_model(SIM_ERR_NONE);
+	arduino_set_clock(&sim);
+	SimCounter collector, others;
+	std::vector<LoRaL2Tdma*> nodes(meters + 1);
+	nodes[0] = new LoRaL2Tdma(sim.radio(sim.add_node()), BAND, SPREAD, BWIDTH,
+			0, 0, LORAL2_TDMA_NO_SLOT, &collector);
+	// the slot count must fit the beacon
+	if (nodes[0]->set_coordinator(0, len) ||
+			nodes[0]->set_coordinator(LORAL2_TDMA_MAX_SLOTS + 1, len) ||
+			nodes[0]->synced() || !nodes[0]->set_coordinator(meters, len)) {
+		printf("TDMA: bad slot count accepted\n");
+		exit(1);
+	}
+	for (int i = 1; i <= meters; ++i) {
+		nodes[i] = new LoRaL2Tdma(sim.radio(sim.add_node()), BAND, SPREAD, BWIDTH,
+				0, 0, i - 1, &others);
+		sim.link(0, i, 5.0);
+	}
+	uint32_t superframe = nodes[0]->superframe_us();
+	uint32_t guard = nodes[0]->guard_us();
+	uint32_t frame_air = nodes[1]->link()->airtime_us(LORAL2_TDMA_HDR_LEN + len);
+
+	tdma_run(sim, nodes, 2 * superframe);
+	for (int i = 1; i <= meters; ++i) {
+		int32_t error = nodes[i]->network_us() - nodes[0]->network_us();
+		if (!nodes[i]->synced() || error < -2 || error > 2) {
+			printf("TDMA: node %d not in sync, error %ld us\n", i, (long) error);
+			exit(1);
+		}
+	}
+
+	uint64_t start = sim.now_us();
+	int offered = 0;
+	for (uint64_t t = start; t < start + duration; t += superframe) {
+		for (int i = 1; i <= meters; ++i) {
+			LoRaL2Tdma *n = nodes[i];
+			sim.at(t + sim.random() % superframe, [n, &payload, len] {
+				n->send(payload, len);
+			});
+			++offered;
+		}
+	}
+	tdma_run(sim, nodes, start + duration + 2 * superframe);
+	uint32_t tdma_collisions = sim.collisions + sim.half_duplex;
+
+	// coordinator gone: nodes stop sending after a few superframes
+	delete nodes[0];
+	nodes[0] = 0;
+	uint32_t sent = 0;
+	tdma_run(sim, nodes, sim.now_us() + (LORAL2_TDMA_SYNC_LOSS + 1) * superframe);
+	for (int i = 1; i <= meters; ++i) {
+		nodes[i]->send(payload, len);
+		sent += nodes[i]->sent();
+	}
+	tdma_run(sim, nodes, sim.now_us() + 2 * superframe);
+	for (int i = 1; i <= meters; ++i) {
+		if (nodes[i]->synced()) {
+			printf("TDMA: node %d still in sync\n", i);
+			exit(1);
+		}
+		sent -= nodes[i]->sent();
+		delete nodes[i];
+	}
+	if (sent) {
+		printf("TDMA: sent without sync\n");
+		exit(1);
+	}
+
+	// same load, same topology, send as soon as the frame is ready
+	ChannelSim aloha_sim(7);
+	aloha_sim.set_error_model(SIM_ERR_NONE);
+	arduino_set_clock(&aloha_sim);
+	SimCounter aloha_collector;
+	std::vector<LoRaL2*> aloha(meters + 1);
+	aloha[0] = new LoRaL2(aloha_sim.radio(aloha_sim.add_node()), BAND, SPREAD, BWIDTH,
+			0, 0, &aloha_collector);
+	for (int i = 1; i <= meters; ++i) {
+		aloha[i] = new LoRaL2(aloha_sim.radio(aloha_sim.add_node()), BAND, SPREAD, BWIDTH,
+				0, 0, &others);
+		aloha_sim.link(0, i, 5.0);
+	}
+	for (uint64_t t = 0; t < duration; t += superframe) {
+		for (int i = 1; i <= meters; ++i) {
+			LoRaL2 *n = aloha[i];
+			aloha_sim.at(t + aloha_sim.random() % superframe, [n] {
+				sim_send(n, len + LORAL2_TDMA_HDR_LEN);
+			});
+		}
+	}
+	aloha_sim.run_until(duration + 2 * superframe);
+	arduino_set_clock(0);
+	for (int i = 0; i <= meters; ++i) {
+		delete aloha[i];
+	}
+
+	printf("TDMA: %d meters, superframe %lu ms, guard %lu us, offered load %.2f\n",
+		meters, (unsigned long) superframe / 1000, (unsigned long) guard,
+		(double) offered * frame_air / duration);
+	printf("TDMA: %d of %d frames delivered (%.1f/s), %lu collisions; "
+		"ALOHA: %d delivered (%.1f/s), %lu collisions\n",
+		collector.ok, offered, collector.ok * 1e6 / duration,
+		(unsigned long) tdma_collisions, aloha_collector.ok,
+		aloha_collector.ok * 1e6 / duration,
+		(unsigned long) (aloha_sim.collisions + aloha_sim.half_duplex));
+	if (tdma_collisions || collector.bad || collector.ok < offered * 98 / 100 ||
+			collector.ok <= aloha_collector.ok) {
+		printf("TDMA: no better than ALOHA\n");
+		exit(1);
+	}
+}
+
+// SF12: the guard no longer fits in 16 bits, nodes must still get it
+// from the beacon and keep to their slots
+static void test_tdma_sf12()
+{
+	const int meters = 3;
+	const int rounds = 4;
+	const size_t len = 20;
+	uint8_t payload[len];
+	memset(payload, 0x55, len);
+
+	ChannelSim sim(12);
+	sim.set_error_model(SIM_ERR_NONE);
+	arduino_set_clock(&sim);
+	SimCounter collector, others;
+	std::vector<LoRaL2Tdma*> nodes(meters + 1);
+	nodes[0] = new LoRaL2Tdma(sim.radio(sim.add_node()), BAND, 12, BWIDTH,
+			0, 0, LORAL2_TDMA_NO_SLOT, &collector);
+	nodes[0]->set_coordinator(meters, len);
+	for (int i = 1; i <= meters; ++i) {
+		nodes[i] = new LoRaL2Tdma(sim.radio(sim.add_node()), BAND, 12, BWIDTH,
+				0, 0, i - 1, &others);
+		sim.link(0, i, 5.0);
+	}
+	uint32_t superframe = nodes[0]->superframe_us();
+	uint32_t guard = nodes[0]->guard_us();
+
+	tdma_run(sim, nodes, 2 * superframe);
+	for (int i = 1; i <= meters; ++i) {
+		if (!nodes[i]->synced() || nodes[i]->guard_us() != guard ||
+				nodes[i]->superframe_us() != superframe) {
+			printf("TDMA SF12: node %d guard %lu us, coordinator %lu us\n", i,
+				(unsigned long) nodes[i]->guard_us(), (unsigned long) guard);
+			exit(1);
+		}
+	}
+
+	uint64_t start = sim.now_us();
+	for (int k = 0; k < rounds; ++k) {
+		for (int i = 1; i <= meters; ++i) {
+			LoRaL2Tdma *n = nodes[i];
+			sim.at(start + k * superframe + sim.random() % superframe,
+				[n, &payload, len] {
+					n->send(payload, len);
+				});
+		}
+	}
+	tdma_run(sim, nodes, start + (rounds + 2) * superframe);
+	arduino_set_clock(0);
+	for (int i = 0; i <= meters; ++i) {
+		delete nodes[i];
+	}
+
+	printf("TDMA SF12: superframe %lu ms, guard %lu us, %d of %d frames delivered\n",
+		(unsigned long) superframe / 1000, (unsigned long) guard,
+		collector.ok, meters * rounds);
+	if (guard <= 0xffff || sim.collisions || sim.half_duplex || collector.bad ||
+			collector.ok != meters * rounds) {
+		printf("TDMA SF12: frames lost\n");
+		exit(1);
+	}
+}
+
+// Virtual clock behind arduino_millis() and arduino_micros()
+static void test_clock()
+{
+	ArduinoVirtualClock clock(5000);
+	arduino_set_clock(&clock);
+	if (arduino_millis() != 5 || arduino_micros() != 5000) {
+		printf("Clock: bad start time\n");
+		exit(1);
+	}
+	clock.advance(3600ULL * 1000000);
+	if (arduino_millis() != 3600005) {
+		printf("Clock: advance failed\n");
+		exit(1);
+	}
+	// micros() wraps around after 2^32 us, as in Arduino
+	clock.set(0x100000000ULL + 7);
+	if (arduino_micros() != 7) {
+		printf("Clock: micros() did not wrap\n");
+		exit(1);
+	}
+	arduino_set_clock(0);
+
+	uint32_t t0 = arduino_micros();
+	while (arduino_micros() == t0);
+	if (arduino_millis() == 0) {
+		printf("Clock: wall clock not restored\n");
+		exit(1);
+	}
+}
+
+// AESFast256 must be bit-compatible with AES256, in both code paths
+static void test_aes_fast()
+{
+	uint8_t key[32];
+	for (size_t i = 0; i < sizeof(key); ++i) {
+		key[i] = random() % 256;
+	}
+
+	AES256 ref;
+	AESFast256 fast;
+	ref.setKey(key, sizeof(key));
+	fast.setKey(key, sizeof(key));
+
+	printf("AES-NI available: %d\n", !!AESFast256::cpuHasAESNI());
+
+	for (int ni = 0; ni < 2; ++ni) {
+		fast.setAccelerated(ni);
+		for (int n = 0; n < 1000; ++n) {
+			uint8_t plain[16], exp[16], res[16];
+			for (size_t i = 0; i < sizeof(plain); ++i) {
+				plain[i] = random() % 256;
+			}
+			ref.encryptBlock(exp, plain);
+			fast.encryptBlock(res, plain);
+			if (memcmp(exp, res, sizeof(exp))) {
+				printf("AESFast256 encryption mismatch, NI %d\n", ni);
+				exit(1);
+			}
+			// in-place decryption
+			fast.decryptBlock(res, res);
+			if (memcmp(plain, res, sizeof(plain))) {
+				printf("AESFast256 decryption mismatch, NI %d\n", ni);
+				exit(1);
+			}
+		}
+
+		// multi-block API, with and without a partial group of blocks
+		for (size_t count = 0; count <= 9; ++count) {
+			uint8_t plain[9 * 16], exp[9 * 16], res[9 * 16];
+			for (size_t i = 0; i < sizeof(plain); ++i) {
+				plain[i] = random() % 256;
+			}
+			for (size_t b = 0; b < count; ++b) {
+				ref.encryptBlock(exp + b * 16, plain + b * 16);
+			}
+			fast.encryptBlocks(res, plain, count);
+			if (memcmp(exp, res, count * 16)) {
+				printf("AESFast256 multi-block encryption mismatch, NI %d\n", ni);
+				exit(1);
+			}
+			fast.decryptBlocks(res, res, count);
+			if (memcmp(plain, res, count * 16)) {
+				printf("AESFast256 multi-block decryption mismatch, NI %d\n", ni);
+				exit(1);
+			}
+		}
+
+		// CBC decryption, chained from an IV
+		uint8_t iv[16], plain[5 * 16], enc[5 * 16], res[5 * 16];
+		for (size_t i = 0; i < sizeof(iv); ++i) {
+			iv[i] = random() % 256;
+		}
+		for (size_t i = 0; i < sizeof(plain); ++i) {
+			plain[i] = random() % 256;
+		}
+		for (size_t b = 0; b < 5; ++b) {
+			const uint8_t *prev = b ? enc + (b - 1) * 16 : iv;
+			for (size_t i = 0; i < 16; ++i) {
+				res[i] = plain[b * 16 + i] ^ prev[i];
+			}
+			ref.encryptBlock(enc + b * 16, res);
+		}
+		fast.decryptBlocksCBC(res, enc, 5, iv);
+		if (memcmp(plain, res, sizeof(plain))) {
+			printf("AESFast256 CBC decryption mismatch, NI %d\n", ni);
+			exit(1);
+		}
+		// unaligned buffers take the octet-wise XOR
+		uint8_t odd_enc[1 + sizeof(enc)], odd_res[3 + sizeof(res)];
+		memcpy(odd_enc + 1, enc, sizeof(enc));
+		fast.decryptBlocksCBC(odd_res + 3, odd_enc + 1, 5, iv);
+		if (memcmp(plain, odd_res + 3, sizeof(plain))) {
+			printf("AESFast256 unaligned CBC decryption mismatch, NI %d\n", ni);
+			exit(1);
+		}
+	}
+}
+
+static void __attribute__((noinline)) dirty_stack(uint8_t fill)
+{
+	volatile uint8_t junk[4096];
+	for (size_t i = 0; i < sizeof(junk); ++i) {
+		junk[i] = fill;
+	}
+}
+
+// Blocks beyond the correction capacity must be rejected (or miscorrected)
+// without overflowing the decoder workspace, and the outcome must not
+// depend on what was on the stack before. Build with -fsanitize=address
+// to catch overflows.
+static void test_rs_decoder()
+{
+	RS::ReedSolomon<50, 10> rs;
+	uint8_t msg[50], block[60], bad[60], out1[50], out2[50];
+	int rejected = 0;
+
+	for (int n = 0; n < 5000; ++n) {
+		for (size_t i = 0; i < sizeof(msg); ++i) {
+			msg[i] = random() % 256;
+		}
+		rs.Encode(msg, block);
+
+		// correctable: up to 5 symbols
+		memcpy(bad, block, sizeof(bad));
+		for (int e = 0; e < 5; ++e) {
+			bad[random() % sizeof(bad)] ^= 1 + random() % 255;
+		}
+		dirty_stack(0xff);
+		if (rs.Decode(bad, out1) || memcmp(out1, msg, sizeof(msg))) {
+			printf("RS decoder: correctable block %d not corrected\n", n);
+			exit(1);
+		}
+
+		// more than 5 symbols, unless positions repeat
+		memcpy(bad, block, sizeof(bad));
+		int errors = 6 + random() % 20;
+		for (int e = 0; e < errors; ++e) {
+			bad[random() % sizeof(bad)] ^= 1 + random() % 255;
+		}
+		dirty_stack(0x00);
+		int r1 = rs.Decode(bad, out1);
+		dirty_stack(0xff);
+		int r2 = rs.Decode(bad, out2);
+		if (r1 != r2 || (!r1 && memcmp(out1, out2, sizeof(out1)))) {
+			printf("RS decoder: block %d decoded differently twice\n", n);
+			exit(1);
+		}
+		rejected += r1 != 0;
+	}
+	printf("RS decoder: %d of 5000 uncorrectable blocks rejected\n", rejected);
+}
+
+int main()
+{
+	// calls srandom(time of day) indirectly
+	arduino_random(0, 2);
 
 	observer = new TestObserver();
+	test_clock();
+	test_aes_fast();
+	test_rs_decoder();
 	test_encryption();
+	test_deferred();
+	test_dedup();
+	test_addressing();
+	test_receiver();
+	test_send_reports();
+	test_rx_info();
+	test_compress();
+	test_telemetry();
+#ifdef LORAL2_TRACE
+	test_trace();
+#endif
+	test_worker();
+	test_multi();
+	test_fec_threads();
+	test_rs_tables();
+	test_fec_ladder();
+	test_channel_sim();
+	test_emu_net();
+	test_mesh();
+	test_router();
+	test_tdma();
+	test_tdma_sf12();
 	test_1(0);
 	test_1("abracadabra");
 	test_1("");
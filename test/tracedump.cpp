@@ -0,0 +1,85 @@
+/*
+ * LoRaL2 (LoRa layer-2) project
+ * Copyright (c) 2021 PU5EPX
+ */
+
+// Prints a LoRaL2 trace dump (see Trace.h) as a timeline. The dump may
+// be binary, or hex text as captured from a serial console (anything
+// but hex digits is ignored).
+//
+// Usage: ./tracedump [file]   (default: stdin)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <vector>
+
+#include "Trace.h"
+
+static int hex_value(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+static std::vector<uint8_t> from_hex(const std::vector<uint8_t> &text)
+{
+	std::vector<uint8_t> bin;
+	int hi = -1;
+	for (size_t i = 0; i < text.size(); ++i) {
+		int v = hex_value(text[i]);
+		if (v < 0) {
+			continue;
+		}
+		if (hi < 0) {
+			hi = v;
+		} else {
+			bin.push_back((hi << 4) | v);
+			hi = -1;
+		}
+	}
+	return bin;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = argc > 1 ? fopen(argv[1], "rb") : stdin;
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> dump;
+	int c;
+	while ((c = fgetc(f)) != EOF) {
+		dump.push_back(c);
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+	if (dump.size() < 4 || memcmp(dump.data(), "L2TR", 4)) {
+		dump = from_hex(dump);
+	}
+
+	size_t max = dump.size() / LORAL2_TRACE_REC_LEN + 1;
+	std::vector<LoRaL2TraceRecord> r(max);
+	uint32_t total;
+	int n = loral2_trace_parse(dump.data(), dump.size(), r.data(), max, total);
+	if (n < 0) {
+		fprintf(stderr, "not a trace dump (version %d)\n", LORAL2_TRACE_VERSION);
+		return 1;
+	}
+
+	printf("# %d events, %lu lost\n", n, (unsigned long) (total - n));
+	printf("# %12s %10s unit event            a           b\n", "time_us", "delta_us");
+	for (int i = 0; i < n; ++i) {
+		// unsigned difference survives micros() wraparound
+		uint32_t delta = i ? r[i].time_us - r[i - 1].time_us : 0;
+		printf("  %12lu %+10ld %4d %-12s %6d %11ld\n",
+			(unsigned long) r[i].time_us, (long) (int32_t) delta, r[i].unit,
+			loral2_trace_event_name(r[i].event), r[i].a, (long) r[i].b);
+	}
+	return 0;
+}